@@ -16,6 +16,25 @@
 LOCAL_PATH := $(call my-dir)
 
 
+# everything but the module entry point, shared with the tests
+nanohub_hal_src_files := \
+  nanohub.cpp  \
+  nanohub_arena.cpp  \
+  nanohub_arbiter.cpp  \
+  nanohub_batching.cpp  \
+  nanohub_cal.cpp  \
+  nanohub_comms.cpp  \
+  nanohub_config.cpp  \
+  nanohub_decimator.cpp  \
+  nanohub_flush.cpp  \
+  nanohub_fusion.cpp  \
+  nanohub_gaps.cpp  \
+  nanohub_info.cpp  \
+  nanohub_reader.cpp  \
+  nanohub_spin.cpp  \
+  nanohub_trace.cpp  \
+  nanohub_txn.cpp  \
+
 # HAL module implemenation, not prelinked, and stored in
 # hw/<SENSORS_HARDWARE_MODULE_ID>.<ro.hardware.sensor>.so
 # hw/<SENSORS_HARDWARE_MODULE_ID>.<ro.product.board>.so
@@ -31,8 +50,10 @@ LOCAL_MODULE_OWNER := google
 
 LOCAL_SRC_FILES := \
   sensors.cpp      \
-  nanohub.cpp  \
+  $(nanohub_hal_src_files)
 
 LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libdl
 
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
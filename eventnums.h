@@ -22,6 +22,7 @@
 #define EVT_NO_FIRST_SENSOR_EVENT        0x00000200    //sensor type SENSOR_TYPE_x produces events of type EVT_NO_FIRST_SENSOR_EVENT + SENSOR_TYPE_x for all Google-defined sensors
 #define EVT_NO_SENSOR_CONFIG_EVENT       0x00000300    //event to configure sensors
 #define EVT_APP_START                    0x00000400    //sent when an app can actually start
+#define EVT_NO_FIRST_COMPRESSED_SENSOR_EVENT 0x00000500 //same as EVT_NO_FIRST_SENSOR_EVENT, samples in the compressed format
 
 /*
  * These events are in private OS-reserved range, and are sent targettedly
@@ -31,13 +31,21 @@
 #include <utils/Timers.h>
 
 #include "nanohub.h"
+#include "nanohub_info.h"
 #include "sensType.h"
 #include "eventnums.h"
 #include "nanohub_sensors.h"
 #include "nanohubPacket.h"
+#include "nanohub_quat.h"
+#include "nanohub_reader.h"
 
 #define LOG_TAG "NANOHUB"
 
+/* The process wide hub, shared by every open of the HAL */
+static pthread_mutex_t sHubLock = PTHREAD_MUTEX_INITIALIZER;
+static NanoHub *sHub;
+static int sHubRefs;
+
 /*****************************************************************************/
 static int min(int a, int b) {
     return (a < b) ? a : b;
@@ -68,12 +76,53 @@ static int handle_to_sensor_type(int handle)
 			return SENSOR_TYPE_STEP_DETECTOR;
 		case NANOHUB_SC:
 			return SENSOR_TYPE_STEP_COUNTER;
+		case NANOHUB_WIFI:
+			return SENSOR_TYPE_NANOHUB_WIFI_SCAN;
+		case NANOHUB_GYRO_UNCAL:
+			return SENSOR_TYPE_GYROSCOPE_UNCALIBRATED;
+		case NANOHUB_MAG_UNCAL:
+			return SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED;
+		case NANOHUB_ANY_MOTION:
+			return SENSOR_TYPE_NANOHUB_ANY_MOTION;
+		case NANOHUB_NO_MOTION:
+			return SENSOR_TYPE_NANOHUB_NO_MOTION;
+		case NANOHUB_SIG_MOTION:
+			return SENSOR_TYPE_SIGNIFICANT_MOTION;
+		case NANOHUB_FLAT:
+			return SENSOR_TYPE_NANOHUB_FLAT;
+		case NANOHUB_BARO:
+			return SENSOR_TYPE_PRESSURE;
+		case NANOHUB_TEMP:
+			return SENSOR_TYPE_AMBIENT_TEMPERATURE;
+		case NANOHUB_ALS:
+			return SENSOR_TYPE_LIGHT;
+		case NANOHUB_PROX:
+			return SENSOR_TYPE_PROXIMITY;
+		case NANOHUB_HR_ECG:
+		case NANOHUB_HR_PPG:
+			return SENSOR_TYPE_HEART_RATE;
+		case NANOHUB_GESTURE:
+			return SENSOR_TYPE_NANOHUB_GESTURE;
+		case NANOHUB_TILT:
+			return SENSOR_TYPE_TILT_DETECTOR;
+		case NANOHUB_DOUBLE_TWIST:
+			return SENSOR_TYPE_NANOHUB_DOUBLE_TWIST;
+		case NANOHUB_DOUBLE_TAP:
+			return SENSOR_TYPE_NANOHUB_DOUBLE_TAP;
+		case NANOHUB_WIN_ORIEN:
+			return SENSOR_TYPE_NANOHUB_WIN_ORIENTATION;
+		case NANOHUB_HALL:
+			return SENSOR_TYPE_NANOHUB_HALL;
+		case NANOHUB_ACTIVITY:
+			return SENSOR_TYPE_NANOHUB_ACTIVITY;
+		case NANOHUB_VSYNC:
+			return SENSOR_TYPE_NANOHUB_VSYNC;
         default:
         	return -1;
     }
 }
 
-static int handle_to_nanohub_type(int handle)
+int handle_to_nanohub_type(int handle)
 {
     switch (handle) {
         case NANOHUB_ACCEL:
@@ -83,7 +132,6 @@ static int handle_to_nanohub_type(int handle)
 		case NANOHUB_GYRO:
         	return SENS_TYPE_GYRO;
 		case NANOHUB_ORIEN:
-        	return SENS_TYPE_ORIENTATION;
 		case NANOHUB_RV:
             return SENS_TYPE_ROTATION_VECTOR;
 		case NANOHUB_LA:
@@ -98,6 +146,49 @@ static int handle_to_nanohub_type(int handle)
 			return SENS_TYPE_STEP_DETECT;
 		case NANOHUB_SC:
 			return SENS_TYPE_STEP_COUNT;
+		case NANOHUB_WIFI:
+			return SENS_TYPE_WIFI_SCAN;
+		/* uncalibrated streams are rebuilt on the host from the calibrated ones */
+		case NANOHUB_GYRO_UNCAL:
+			return SENS_TYPE_GYRO;
+		case NANOHUB_MAG_UNCAL:
+			return SENS_TYPE_MAG;
+		case NANOHUB_ANY_MOTION:
+			return SENS_TYPE_ANY_MOTION;
+		case NANOHUB_NO_MOTION:
+			return SENS_TYPE_NO_MOTION;
+		case NANOHUB_SIG_MOTION:
+			return SENS_TYPE_SIG_MOTION;
+		case NANOHUB_FLAT:
+			return SENS_TYPE_FLAT;
+		case NANOHUB_BARO:
+			return SENS_TYPE_BARO;
+		case NANOHUB_TEMP:
+			return SENS_TYPE_TEMP;
+		case NANOHUB_ALS:
+			return SENS_TYPE_ALS;
+		case NANOHUB_PROX:
+			return SENS_TYPE_PROX;
+		case NANOHUB_HR_ECG:
+			return SENS_TYPE_HEARTRATE_ECG;
+		case NANOHUB_HR_PPG:
+			return SENS_TYPE_HEARTRATE_PPG;
+		case NANOHUB_GESTURE:
+			return SENS_TYPE_GESTURE;
+		case NANOHUB_TILT:
+			return SENS_TYPE_TILT;
+		case NANOHUB_DOUBLE_TWIST:
+			return SENS_TYPE_DOUBLE_TWIST;
+		case NANOHUB_DOUBLE_TAP:
+			return SENS_TYPE_DOUBLE_TAP;
+		case NANOHUB_WIN_ORIEN:
+			return SENS_TYPE_WIN_ORIENTATION;
+		case NANOHUB_HALL:
+			return SENS_TYPE_HALL;
+		case NANOHUB_ACTIVITY:
+			return SENS_TYPE_ACTIVITY;
+		case NANOHUB_VSYNC:
+			return SENS_TYPE_VSYNC;
         default:
         	return -1;
     }
@@ -128,194 +219,2093 @@ static int nanohub_type_to_handle(int handle)
 			return NANOHUB_SD;
 		case SENS_TYPE_STEP_COUNT:
 			return NANOHUB_SC;
+		case SENS_TYPE_WIFI_SCAN:
+			return NANOHUB_WIFI;
+		case SENS_TYPE_ANY_MOTION:
+			return NANOHUB_ANY_MOTION;
+		case SENS_TYPE_NO_MOTION:
+			return NANOHUB_NO_MOTION;
+		case SENS_TYPE_SIG_MOTION:
+			return NANOHUB_SIG_MOTION;
+		case SENS_TYPE_FLAT:
+			return NANOHUB_FLAT;
+		case SENS_TYPE_BARO:
+			return NANOHUB_BARO;
+		case SENS_TYPE_TEMP:
+			return NANOHUB_TEMP;
+		case SENS_TYPE_ALS:
+			return NANOHUB_ALS;
+		case SENS_TYPE_PROX:
+			return NANOHUB_PROX;
+		case SENS_TYPE_HEARTRATE_ECG:
+			return NANOHUB_HR_ECG;
+		case SENS_TYPE_HEARTRATE_PPG:
+			return NANOHUB_HR_PPG;
+		case SENS_TYPE_GESTURE:
+			return NANOHUB_GESTURE;
+		case SENS_TYPE_TILT:
+			return NANOHUB_TILT;
+		case SENS_TYPE_DOUBLE_TWIST:
+			return NANOHUB_DOUBLE_TWIST;
+		case SENS_TYPE_DOUBLE_TAP:
+			return NANOHUB_DOUBLE_TAP;
+		case SENS_TYPE_WIN_ORIENTATION:
+			return NANOHUB_WIN_ORIEN;
+		case SENS_TYPE_HALL:
+			return NANOHUB_HALL;
+		case SENS_TYPE_ACTIVITY:
+			return NANOHUB_ACTIVITY;
+		case SENS_TYPE_VSYNC:
+			return NANOHUB_VSYNC;
         default:
         	return -1;
     }
 }
 
+/*
+ * handle_to_num_axis: wire format (enum NumAxis) of a handle's hub stream.
+ */
+static int handle_to_num_axis(int handle)
+{
+    switch (handle) {
+        case NANOHUB_WIFI:
+            return NUM_AXIS_WIFI;
+        case NANOHUB_SD:
+        case NANOHUB_SC:
+        case NANOHUB_BARO:
+        case NANOHUB_TEMP:
+        case NANOHUB_ALS:
+        case NANOHUB_PROX:
+        case NANOHUB_HR_ECG:
+        case NANOHUB_HR_PPG:
+            return NUM_AXIS_ONE;
+        case NANOHUB_ANY_MOTION:
+        case NANOHUB_NO_MOTION:
+        case NANOHUB_SIG_MOTION:
+        case NANOHUB_FLAT:
+        case NANOHUB_GESTURE:
+        case NANOHUB_TILT:
+        case NANOHUB_DOUBLE_TWIST:
+        case NANOHUB_DOUBLE_TAP:
+        case NANOHUB_WIN_ORIEN:
+        case NANOHUB_HALL:
+        case NANOHUB_ACTIVITY:
+        case NANOHUB_VSYNC:
+            return NUM_AXIS_EMBEDDED;
+        default:
+            return NUM_AXIS_THREE;
+    }
+}
+
+/*
+ * packet_samples: how many samples the hub sent in one event packet,
+ * whatever the HAL ends up delivering of them. Every sample format but
+ * the embedded one, a single value, starts with a SensorFirstSample.
+ */
+static int packet_samples(const struct EvtPacket *packet)
+{
+    int type = packet->sensType & ~0x0ff;
+    int sensor_id;
+
+    if (type != EVT_NO_FIRST_SENSOR_EVENT && type != EVT_NO_FIRST_COMPRESSED_SENSOR_EVENT) {
+        return 0;
+    }
+
+    sensor_id = nanohub_type_to_handle(0x0ff & packet->sensType);
+    if (handle_to_sensor_type(sensor_id) < 0) {
+        return 0;
+    } else if (handle_to_num_axis(sensor_id) == NUM_AXIS_EMBEDDED) {
+        return 1;
+    }
+
+    return packet->firstSample.numSamples;
+}
+
+/*
+ * rate_lookup: smallest supported rate that is at least wanted, or the
+ * fastest one if none is. A somewhat faster rate that is an exact
+ * multiple of wanted wins over it, so host decimation lands on wanted
+ * instead of delivering the faster rate. rates must be sorted ascending.
+ */
+static uint32_t rate_lookup(const uint32_t *rates, uint8_t numRates, uint32_t wanted)
+{
+    int lo = 0, hi = numRates - 1, mid;
+
+    if (wanted >= rates[hi]) {
+        return rates[hi];
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (rates[mid] < wanted) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (int i = lo; i < numRates && rates[i] / NANOHUB_RATE_MULTIPLE_MAX <= wanted; i++) {
+        if (rates[i] % wanted == 0) {
+            return rates[i];
+        }
+    }
+
+    return rates[lo];
+}
+
 /*
  * Constructor.
  *
  * Setup and open the ring buffer.
  */
-NanoHub::NanoHub()
+NanoHub::NanoHub(const struct sensor_t *list, int count)
+    : NanoHub(list, count, open(NANOHUB_DEV_PATH, O_RDWR | O_NONBLOCK))
+{
+}
+
+/*
+ * Setup on dataFd: /dev/nanohub, or a nonblocking fake of it in tests,
+ * which also keep their calibration at calPath.
+ */
+NanoHub::NanoHub(const struct sensor_t *list, int count, int dataFd, const char *calPath)
 {
-    const char *nanohub_path = "/dev/nanohub";
+    char filter[PROPERTY_VALUE_MAX];
+    enum nanohub_decimation_mode mode;
 
-    mDataFd = open(nanohub_path, O_RDWR);
+    mDataFd = dataFd;
     if (mDataFd < 0) {
-        ALOGE("open file '%s' failed: %s\n", nanohub_path, strerror(errno));
+        ALOGE("open file '%s' failed: %s\n", NANOHUB_DEV_PATH, strerror(errno));
+    }
+
+    pthread_mutex_init(&mConfigLock, NULL);
+    pthread_mutex_init(&mClientLock, NULL);
+    pthread_mutex_init(&mReadLock, NULL);
+    mConfigGen = 0;
+    mClosing = false;
+    mReader = NULL;
+    memset(mClientMask, 0, sizeof(mClientMask));
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        mWakeFds[c] = -1;
+        mBusy[c] = 0;
+        mDetaching[c] = false;
     }
+
+    mReopenDelay = NANOHUB_REOPEN_MIN_MS;
+    mReopenDue = 0;
+    mReopenOwed = false;
+    mResetPending = false;
+
+    /* acknowledged config writes need the comms node */
+    mAcked = mTxn.isOpen() && property_get_bool("persist.nanohub.config_acks", true);
+    mConfigStale = 0;
+    mAcksOwed = false;
+    mRebatchOwed = false;
+    mReplayOwed = false;
+    mDisarmOwed = 0;
+    mCalRequested = 0;
     memset(mSensorConfig, 0, sizeof(struct sensor_config) * NANOHUB_ID_MAX);
+    memset(mRatePlan, 0, sizeof(struct sensor_rate_plan) * NANOHUB_ID_MAX);
+    memset(mBias, 0, sizeof(struct sensor_bias) * NANOHUB_ID_MAX);
+    memset(mLastEvent, 0, sizeof(mLastEvent));
+    mLastEventValid = 0;
+    memset(mDirectPending, 0, sizeof(mDirectPending));
+    mBatch.block = -1;
+    mBatch.start = 0;
+    mBatch.count = 0;
+    memset(mWifiSeen, 0, sizeof(mWifiSeen));
+    mWifiSeenCount = 0;
+    mWifiWindowStart = 0;
+
+    for (int i = 0; i < count; i++) {
+        initRatePlan(&list[i]);
+        mBatching.setFifoSize(list[i].fifoMaxEventCount);
+        if (NanoHubFusion::useHostFusion(list[i].handle)) {
+            ALOGI("fusing handle %d on the host", list[i].handle);
+            mArbiter.setHostFused(list[i].handle);
+        }
+    }
+
+    /*
+     * Ask for compressed accel/gyro/mag batches; firmware that doesn't
+     * know the bit ignores it and keeps sending floats.
+     */
+    mCompress = property_get_bool("persist.nanohub.compress", true);
+
+    /* lost samples are always counted, logging each gap is for tooling */
+    mGaps.setVerbose(property_get_bool("persist.nanohub.gap_log", false));
+
+    mBatching.setEnabled(property_get_bool("persist.nanohub.adaptive_batching", false));
+
+    property_get("persist.nanohub.decim_filter", filter, "boxcar");
+    mode = strcmp(filter, "drop") ? NANOHUB_DECIMATE_BOXCAR : NANOHUB_DECIMATE_DROP;
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        mDecimator.setMode(i, mode);
+    }
+
+    mCalibration.load(calPath);
+    pthread_mutex_lock(&mConfigLock);
+    restoreCalibration();
+    completeConfig();
+    pthread_mutex_unlock(&mConfigLock);
+
+    /*
+     * persist.nanohub.reader moves reading and decoding to a thread of
+     * its own from the start; otherwise it only comes up when a second
+     * client attaches.
+     */
+    if (property_get_bool("persist.nanohub.reader", false)) {
+        startReader();
+    }
 }
 
 NanoHub::~NanoHub()
 {
-    /* Silence all the sensors, so that we can stop the buffer */
-    for (size_t i = 0 ; i < NANOHUB_ID_MAX ; i++) {
-        activate(i, 0);
+    /*
+     * Get every client's poll thread out first: detach() wakes it up and
+     * waits until it has left. Then stop the reader, which sees mClosing
+     * and stops decoding, and silence all the sensors, so that we can
+     * stop the buffer.
+     */
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (mWakeFds[c] >= 0) {
+            detach(c);
+        }
+    }
+    __atomic_store_n(&mClosing, true, __ATOMIC_RELEASE);
+    delete mReader;
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        for (size_t i = 0 ; i < NANOHUB_ID_MAX ; i++) {
+            activate(c, i, 0);
+        }
     }
     close(mDataFd);
+    pthread_mutex_destroy(&mConfigLock);
+    pthread_mutex_destroy(&mClientLock);
+    pthread_mutex_destroy(&mReadLock);
+    NanoHubTrace::flush();
+
+    mArena.release(&mBatch);
+    mArena.dump();
 }
 
 /*
- * getFd: retrieve the ring file descriptor.
- *
- * Needed for CrosECSensor creator to listen to the buffer.
+ * acquire: the process wide hub, created by the first caller. Every
+ * acquire() is paired with a put(); the last one tears the hub down.
  */
-int NanoHub::getFd(void)
+NanoHub *NanoHub::acquire(const struct sensor_t *list, int count)
 {
-    return mDataFd;
+    NanoHub *hub;
+
+    pthread_mutex_lock(&sHubLock);
+    if (!sHub) {
+        sHub = new NanoHub(list, count);
+    }
+    sHubRefs++;
+    hub = sHub;
+    pthread_mutex_unlock(&sHubLock);
+
+    return hub;
+}
+
+void NanoHub::put(NanoHub *hub)
+{
+    pthread_mutex_lock(&sHubLock);
+    if (hub == sHub && --sHubRefs == 0) {
+        delete sHub;
+        sHub = NULL;
+    }
+    pthread_mutex_unlock(&sHubLock);
 }
 
-int NanoHub::flush(int handle)
+/*
+ * startReader: hand the hub over to a reader thread feeding every
+ * client's queue. Once published, inline reads stop and each attached
+ * client is woken up to switch over to its queue. Called with
+ * mClientLock held, or from the constructor.
+ */
+int NanoHub::startReader(void)
 {
+    const char wake = NANOHUB_WAKE_MESSAGE;
+    NanoHubReader *reader;
     int err;
-    int sensor_handle = handle_to_sensor_type(handle);
-    struct sensor_config *config;
 
-    if (sensor_handle < 0) {
-        return -1;
+    reader = new NanoHubReader(this,
+                               property_get_int32("persist.nanohub.reader_cpu", -1),
+                               property_get_int32("persist.nanohub.reader_prio", 0));
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (mWakeFds[c] >= 0) {
+            reader->attach(c);
+        }
     }
 
-    config = &mSensorConfig[sensor_handle];
-    config->evtType = EVT_NO_SENSOR_CONFIG_EVENT;
-    config->sensorType = handle_to_nanohub_type(handle);
-    config->calibrate = 0;
-    config->reserved = 0;
-    config->flush = 1;
-
+    err = reader->start();
+    if (err < 0) {
+        delete reader;
+        return err;
+    }
 
-    ALOGE("Flush Handle:%d", handle);
+    pthread_mutex_lock(&mReadLock);
+    __atomic_store_n(&mReader, reader, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mReadLock);
 
-    err = write(mDataFd, config, sizeof(struct sensor_config));
-    if (err < 0) {
-        ALOGE("Write flush error");
-        return -1;
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (mWakeFds[c] >= 0 && write(mWakeFds[c], &wake, 1) < 0) {
+            ALOGE("error waking client %d (%s)", c, strerror(errno));
+        }
     }
 
     return 0;
 }
 
-int NanoHub::activate(int handle, int enabled)
+/*
+ * kickReader: get the reader to pick up events produced without the hub.
+ */
+void NanoHub::kickReader(void)
 {
-    int err;
-    int sensor_handle = handle_to_sensor_type(handle);
-    struct sensor_config *config;
+    NanoHubReader *reader = getReader();
 
-    if (sensor_handle < 0) {
-        return -1;
+    if (reader) {
+        reader->kick();
     }
+}
 
-    config = &mSensorConfig[sensor_handle];
-    config->evtType = EVT_NO_SENSOR_CONFIG_EVENT;
-    config->sensorType = handle_to_nanohub_type(handle);
-    config->enable = enabled;
-    config->reserved = 0;
-    config->calibrate = 0;
-    config->flush = 0;
+/*
+ * attach: take a client slot, returning its id, or -EBUSY when they are
+ * all taken. wakeFd is written to when the client has to poll() again.
+ * A second client needs the reader thread, and fails without it.
+ */
+int NanoHub::attach(int wakeFd)
+{
+    int client = -EBUSY;
+    int others = 0;
 
-    err = write(mDataFd, config, sizeof(struct sensor_config));
-    if (err < 0) {
-        ALOGE("set active error:%d",err);
-        return -1;
+    pthread_mutex_lock(&mClientLock);
+
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (mWakeFds[c] >= 0) {
+            others++;
+        } else if (client < 0) {
+            client = c;
+        }
+    }
+    if (client < 0) {
+        pthread_mutex_unlock(&mClientLock);
+        return -EBUSY;
     }
 
-    return 0;
+    mWakeFds[client] = wakeFd;
+    __atomic_store_n(&mDetaching[client], false, __ATOMIC_SEQ_CST);
+    if (mReader) {
+        mReader->attach(client);
+    } else if (others && startReader() < 0) {
+        ALOGE("no reader thread, can't share the hub with another client");
+        mWakeFds[client] = -1;
+        client = -EBUSY;
+    }
+
+    pthread_mutex_unlock(&mClientLock);
+
+    if (client >= 0) {
+        ALOGI("client %d attached, %d others", client, others);
+    }
+
+    return client;
 }
 
-int NanoHub::batch(int handle, int64_t sampling_period_ns, int64_t max_report_latency_ns)
+/*
+ * detach: give up a client slot, releasing whatever the client still had
+ * enabled; sensors other clients keep using stay on. A poll thread of the
+ * client still inside is woken up and waited for first, so neither the
+ * client nor the hub go away under it.
+ */
+void NanoHub::detach(int client)
 {
-    int err;
-    int sensor_handle = handle_to_sensor_type(handle);
-    struct sensor_config *config;
+    const char wake = NANOHUB_WAKE_MESSAGE;
 
-    if (sensor_handle < 0) {
-        return -1;
+    __atomic_store_n(&mDetaching[client], true, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mBusy[client], __ATOMIC_SEQ_CST) &&
+        write(mWakeFds[client], &wake, 1) < 0 && errno != EAGAIN) {
+        ALOGE("error waking client %d (%s)", client, strerror(errno));
+    }
+    while (__atomic_load_n(&mBusy[client], __ATOMIC_SEQ_CST)) {
+        usleep(NANOHUB_DETACH_WAIT_US);
     }
 
-    config = &mSensorConfig[sensor_handle];
-    config->evtType = EVT_NO_SENSOR_CONFIG_EVENT;
-    config->sensorType = handle_to_nanohub_type(handle);
-    config->reserved = 0;
-    config->calibrate = 0;
-    config->flush = 0;
-    config->rate = SENSOR_HZ(1000000000/sampling_period_ns);
-    config->latency = max_report_latency_ns;
+    pthread_mutex_lock(&mClientLock);
+    if (mReader) {
+        mReader->detach(client);
+    }
+    mWakeFds[client] = -1;
+    pthread_mutex_unlock(&mClientLock);
 
-    err = write(mDataFd, config, sizeof(struct sensor_config));
-    if (err < 0) {
-        ALOGE("Set batch err:%d",err);
-        return -1;
+    lockConfig();
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        mArbiter.requestRateChange(client, i, 0, 0);
+        if (mArbiter.isActive(client, i)) {
+            mArbiter.release(client, i);
+            updateHub(i, true);
+        }
     }
+    __atomic_store_n(&mDirectPending[client], 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mConfigLock);
+}
 
-    return 0;
+/*
+ * enter: a poll thread of client starts using the hub; false once the
+ * client is detaching, then it must return without touching it.
+ */
+bool NanoHub::enter(int client)
+{
+    __atomic_fetch_add(&mBusy[client], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&mDetaching[client], __ATOMIC_SEQ_CST)) {
+        leave(client);
+        return false;
+    }
+
+    return true;
 }
 
-int NanoHub::processEvent(sensors_event_t* data, const struct NanohubReadEventResponse *event)
+void NanoHub::leave(int client)
 {
-    int i;
-    uint64_t lastTime;
-    int nanohub_type;
-    int sensor_id;
-    int sensor_type;
-    struct EvtPacket *eventPacket = (struct EvtPacket *)event;
-    struct TripleAxisDataEvent *tri_event =(struct TripleAxisDataEvent *)&eventPacket->referenceTime;
+    __atomic_fetch_sub(&mBusy[client], 1, __ATOMIC_SEQ_CST);
+}
 
-    nanohub_type = 0x0ff & eventPacket->sensType;
+/*
+ * routes: whether ev goes to client. Events tagged for a client go to
+ * that one only, everything else to the clients that have its sensor
+ * enabled.
+ */
+bool NanoHub::routes(int client, const sensors_event_t *ev) const
+{
+    int handle = ev->type == SENSOR_TYPE_META_DATA ? ev->meta_data.sensor : ev->sensor;
 
-    sensor_id = nanohub_type_to_handle(nanohub_type);
-    sensor_type = handle_to_sensor_type(sensor_id);
+    if (ev->reserved0) {
+        return ev->reserved0 == client + 1;
+    }
+    if (handle < 0 || handle >= NANOHUB_ID_MAX) {
+        return true;
+    }
 
-    for (i = 0; i < tri_event->samples[0].firstSample.numSamples; i++) {
+    return (__atomic_load_n(&mClientMask[handle], __ATOMIC_ACQUIRE) & (1U << client)) != 0;
+}
 
-        if (i == 0) {
-            lastTime = eventPacket->referenceTime;
-        } else {
-            lastTime += tri_event->samples[i].deltaTime;
+/*
+ * getFd: retrieve the ring file descriptor.
+ *
+ * Needed for CrosECSensor creator to listen to the buffer.
+ */
+int NanoHub::getFd(void)
+{
+    return mDataFd;
+}
+
+/*
+ * initRatePlan: bounds from the advertised sensor_t, rate table from the
+ * hub SensorInfo when it reported one.
+ */
+void NanoHub::initRatePlan(const struct sensor_t *sensor)
+{
+    const struct NanohubSensorInfoResponse *info;
+    struct sensor_rate_plan *plan;
+    uint32_t rate;
+    int i, j;
+
+    if (sensor->handle < 0 || sensor->handle >= NANOHUB_ID_MAX) {
+        return;
+    }
+    plan = &mRatePlan[sensor->handle];
+    plan->decimation = 1;
+    plan->reportingMode = sensor->flags & REPORTING_MODE_MASK;
+
+    switch (sensor->flags & REPORTING_MODE_MASK) {
+        case SENSOR_FLAG_CONTINUOUS_MODE:
+            break;
+        case SENSOR_FLAG_ONE_SHOT_MODE:
+            plan->fixedRate = SENSOR_RATE_ONESHOT;
+            return;
+        default:
+            plan->fixedRate = SENSOR_RATE_ONCHANGE;
+            return;
+    }
+
+    if (sensor->minDelay > 0) {
+        plan->maxRate = 1024000000ULL / sensor->minDelay;
+    }
+    if (sensor->maxDelay > 0) {
+        plan->minRate = 1024000000ULL / sensor->maxDelay;
+    }
+
+    info = NanoHubInfo::getInstance()->findSensor(handle_to_nanohub_type(sensor->handle));
+    if (!info) {
+        return;
+    }
+
+    /* insertion sort, firmware tables are short and usually sorted already */
+    for (i = 0; i < info->numRates && i < NANOHUB_SENSOR_INFO_RATES_MAX; i++) {
+        rate = info->supportedRates[i];
+        if (rate == 0 || rate >= SENSOR_RATE_ONDEMAND) {
+            continue;
+        }
+        for (j = plan->numRates; j > 0 && plan->rates[j - 1] > rate; j--) {
+            plan->rates[j] = plan->rates[j - 1];
         }
+        plan->rates[j] = rate;
+        plan->numRates++;
+    }
+}
 
-        data->timestamp = lastTime;
+/*
+ * wantedRate: turn a requested period into a rate within the advertised
+ * delays. A period of 0 means as fast as possible.
+ */
+uint32_t NanoHub::wantedRate(int handle, int64_t period_ns)
+{
+    struct sensor_rate_plan *plan = &mRatePlan[handle];
+    uint64_t wanted;
 
-        data->version = sizeof(sensors_event_t);
-        data->sensor = sensor_id;
-        data->type = sensor_type;
-        data->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
-        data->acceleration.x = tri_event->samples[i].x;
-        data->acceleration.y = tri_event->samples[i].y;
-        data->acceleration.z = tri_event->samples[i].z;
-        data++;
+    if (plan->fixedRate) {
+        return plan->fixedRate;
     }
 
-    for (i = 0; i < tri_event->samples[0].firstSample.numFlushes; i++) {
-        data->version = META_DATA_VERSION;
-        data->sensor = 0;
-        data->type = SENSOR_TYPE_META_DATA;
-        data->reserved0 = 0;
-        data->timestamp = 0;
-        data->meta_data.what = META_DATA_FLUSH_COMPLETE;
-        data->meta_data.sensor = sensor_id;
-        data++;
+    if (period_ns <= 0) {
+        wanted = plan->maxRate ? plan->maxRate : UINT32_MAX;
+    } else {
+        wanted = 1024000000000ULL / period_ns;
+    }
+    if (plan->maxRate && wanted > plan->maxRate) {
+        wanted = plan->maxRate;
+    }
+    if (wanted < plan->minRate) {
+        wanted = plan->minRate;
+    }
+    if (wanted == 0) {
+        wanted = 1;
+    } else if (wanted > UINT32_MAX) {
+        wanted = UINT32_MAX;
     }
 
-    return tri_event->samples[0].firstSample.numSamples + tri_event->samples[0].firstSample.numFlushes;
+    return wanted;
 }
 
-int NanoHub::readEvents(sensors_event_t* data, int count)
+/*
+ * planRate: snap a wanted rate up to the next one the hub supports.
+ */
+uint32_t NanoHub::planRate(int handle, uint32_t wanted)
 {
-    int rc;
+    struct sensor_rate_plan *plan = &mRatePlan[handle];
 
-    if (count < 1) {
-        return -EINVAL;
+    if (plan->fixedRate) {
+        return plan->fixedRate;
     }
 
-    rc = read(mDataFd, &mEvents, sizeof(struct NanohubReadEventResponse));
-    if (rc < 0) {
-        ALOGE("rc %d while reading ring\n", rc);
-        return rc;
+    if (wanted == 0) {
+        wanted = plan->minRate ? plan->minRate : SENSOR_HZ(1);
+    }
+
+    return plan->numRates ? rate_lookup(plan->rates, plan->numRates, wanted) : wanted;
+}
+
+/*
+ * updateDecimation: when the hub runs faster than the client asked,
+ * keep every Nth sample on the host.
+ */
+void NanoHub::updateDecimation(int handle)
+{
+    struct sensor_rate_plan *plan = &mRatePlan[handle];
+    uint32_t decimation = 1;
+
+    plan->requestedRate = mArbiter.getMaxRate(handle);
+    if (!plan->fixedRate && plan->requestedRate && plan->hubRate > plan->requestedRate) {
+        decimation = plan->hubRate / plan->requestedRate;
+    }
+
+    plan->decimation = decimation;
+    plan->deliveredRate = plan->hubRate / decimation;
+}
+
+/*
+ * streamOf: the hub stream handle's events are decoded from.
+ */
+int NanoHub::streamOf(int handle) const
+{
+    if (mArbiter.isHostFused(handle)) {
+        return NanoHubFusion::getDriver(handle);
+    }
+
+    return NanoHubArbiter::getSource(handle);
+}
+
+/*
+ * publishConfig: make handle's current configuration visible to the poll
+ * thread. Called with mConfigLock held.
+ */
+void NanoHub::publishConfig(int handle)
+{
+    struct sensor_snapshot snap;
+    uint32_t clients = mArbiter.getClients(handle);
+
+    __atomic_store_n(&mClientMask[handle], clients, __ATOMIC_RELEASE);
+
+    snap.latency = mSensorConfig[streamOf(handle)].latency;
+    snap.hubRate = mRatePlan[handle].hubRate;
+    snap.requestedRate = mRatePlan[handle].requestedRate;
+    snap.decimation = mRatePlan[handle].decimation;
+    snap.active = clients != 0;
+    snap.hubEnabled = mSensorConfig[streamOf(handle)].enable;
+
+    mConfig.publish(handle, &snap);
+}
+
+bool NanoHub::isStreaming(int handle) const
+{
+    struct sensor_snapshot snap;
+
+    mConfig.read(handle, &snap);
+
+    return snap.active;
+}
+
+/*
+ * syncConfig: pick up configuration changes on the poll thread, so that
+ * the decimator, spin and fusion state are only ever touched from there.
+ *
+ * Spinning is for the fastest stream the hub delivers unbatched, if it is
+ * fast enough for poll() wakeups to matter.
+ */
+void NanoHub::syncConfig(void)
+{
+    struct sensor_snapshot snap;
+    uint32_t gen = mConfig.generation();
+    uint32_t fastest = 0;
+    uint64_t fused = 0;
+    int64_t period;
+
+    if (__atomic_load_n(&mAcksOwed, __ATOMIC_ACQUIRE) || owesConfig()) {
+        collectConfig();
+    }
+
+    if (gen == mConfigGen) {
+        return;
+    }
+
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        mConfig.read(i, &snap);
+        mDecimator.setFactor(i, snap.decimation);
+
+        if (snap.active && mArbiter.isHostFused(i)) {
+            fused |= NANOHUB_HANDLE_BIT(i);
+        }
+        if (snap.active && snap.latency == 0 && snap.hubRate >= NANOHUB_SPIN_MIN_RATE &&
+            snap.hubRate < SENSOR_RATE_ONDEMAND && snap.hubRate > fastest) {
+            fastest = snap.hubRate;
+        }
+
+        /* only hub streams of continuous sensors have a period to check */
+        period = 0;
+        if (snap.hubEnabled && snap.hubRate && snap.hubRate < SENSOR_RATE_ONDEMAND &&
+            streamOf(i) == i && mRatePlan[i].reportingMode == SENSOR_FLAG_CONTINUOUS_MODE) {
+            period = 1024000000000LL / snap.hubRate;
+        }
+        mGaps.setPeriod(i, period);
     }
 
-    rc = processEvent(data, &mEvents);
+    mSpin.setPeriod(fastest ? 1024000000000LL / fastest : 0);
+    mFusion.setActive(fused);
+    mConfigGen = gen;
+}
+
+/*
+ * wait: poll() on fds, fds[hubIdx] being the hub, spinning when it pays.
+ * While config work is owed, poll() wakes up every
+ * NANOHUB_OWED_RETRY_MS to try it again. POLLERR or POLLHUP on the hub
+ * is a reset: the hub is left out of poll() until it is reopened, the
+ * next attempt being made here once it is due.
+ */
+int NanoHub::wait(struct pollfd *fds, int nfds, int hubIdx, int timeoutMs)
+{
+    int64_t start, now, elapsed;
+    int rc, ms, due, hubFd;
+    bool reopening;
+
+    for (;;) {
+        syncConfig();
+
+        ms = timeoutMs;
+        if (owesConfig() && (ms < 0 || ms > NANOHUB_OWED_RETRY_MS)) {
+            ms = NANOHUB_OWED_RETRY_MS;
+        }
+
+        hubFd = fds[hubIdx].fd;
+        reopening = __atomic_load_n(&mReopenOwed, __ATOMIC_ACQUIRE);
+        if (reopening) {
+            due = (__atomic_load_n(&mReopenDue, __ATOMIC_ACQUIRE) -
+                   systemTime(SYSTEM_TIME_BOOTTIME)) / 1000000 + 1;
+            due = due > 1 ? due : 1;
+            if (ms < 0 || ms > due) {
+                ms = due;
+            }
+            fds[hubIdx].fd = -1;
+        }
+
+        start = systemTime(SYSTEM_TIME_BOOTTIME);
+        rc = mSpin.wait(fds, nfds, hubIdx, ms);
+        fds[hubIdx].fd = hubFd;
+
+        if (rc > 0 && (fds[hubIdx].revents & (POLLERR | POLLHUP))) {
+            ALOGE("hub poll error (revents 0x%x)", fds[hubIdx].revents);
+            fds[hubIdx].revents = 0;
+            rc--;
+            __atomic_store_n(&mReopenOwed, true, __ATOMIC_RELEASE);
+            reopening = true;
+        }
+        if (reopening) {
+            retryReopen();
+        }
+
+        if (rc > 0 && (fds[hubIdx].revents & POLLIN)) {
+            now = systemTime(SYSTEM_TIME_BOOTTIME);
+            if (mBatching.wake(now, now - start, mGaps.spans())) {
+                __atomic_store_n(&mRebatchOwed, true, __ATOMIC_RELEASE);
+                collectConfig();
+            }
+        }
+
+        if (rc != 0 || timeoutMs == 0) {
+            return rc;
+        }
+        if (timeoutMs > 0) {
+            elapsed = (systemTime(SYSTEM_TIME_BOOTTIME) - start) / 1000000;
+            if (elapsed >= timeoutMs) {
+                return 0;
+            }
+            timeoutMs -= elapsed;
+        }
+    }
+}
+
+/*
+ * owesConfig: whether the poll thread left config work for whoever
+ * takes mConfigLock next.
+ */
+bool NanoHub::owesConfig(void) const
+{
+    return __atomic_load_n(&mDisarmOwed, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&mReplayOwed, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&mRebatchOwed, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * lockConfig: take mConfigLock on a binder thread, doing the work the
+ * poll thread left owing first, so that it happens before this change.
+ */
+void NanoHub::lockConfig(void)
+{
+    pthread_mutex_lock(&mConfigLock);
+    settleOwed();
+}
+
+/*
+ * settleOwed: the config changes the poll thread can't make itself, as
+ * a binder thread may hold mConfigLock across a hub round trip: replay
+ * after a hub reset, disarming one-shots that fired and applying a new
+ * batch latency scale. Whichever thread gets the lock first does them.
+ * Called with mConfigLock held.
+ */
+void NanoHub::settleOwed(void)
+{
+    uint64_t disarm;
+    int handle;
+
+    if (__atomic_exchange_n(&mReplayOwed, false, __ATOMIC_ACQ_REL)) {
+        replayConfig();
+    }
+
+    disarm = __atomic_exchange_n(&mDisarmOwed, 0, __ATOMIC_ACQ_REL);
+    while (disarm) {
+        handle = __builtin_ctzll(disarm);
+        disarm &= disarm - 1;
+        for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+            mArbiter.release(c, handle);
+        }
+        updateHub(handle, false);
+    }
+
+    if (__atomic_exchange_n(&mRebatchOwed, false, __ATOMIC_ACQ_REL)) {
+        rebatch();
+    }
+}
+
+/*
+ * rebatch: resend every running hub stream with the batch controller's
+ * new latency scale applied. Called with mConfigLock held.
+ */
+void NanoHub::rebatch(void)
+{
+    if (__atomic_load_n(&mClosing, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        if (streamOf(i) == i && mSensorConfig[i].enable) {
+            updateHub(i, false);
+        }
+    }
+}
+
+/*
+ * write_config: the fd is nonblocking, so wait a bounded time for the
+ * driver to take the config when its queue is full.
+ */
+static int write_config(int fd, const void *config, size_t len)
+{
+    struct pollfd pfd;
+    int err;
+
+    for (;;) {
+        err = write(fd, config, len);
+        if (err >= 0 || errno != EAGAIN) {
+            return err;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        err = TEMP_FAILURE_RETRY(poll(&pfd, 1, NANOHUB_WRITE_TIMEOUT_MS));
+        if (err <= 0) {
+            errno = err ? errno : ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+void NanoHub::fillConfigHeader(int handle, struct sensor_config *config)
+{
+    config->evtType = EVT_NO_SENSOR_CONFIG_EVENT;
+    config->sensorType = handle_to_nanohub_type(handle);
+    config->reserved = 0;
+    config->setBias = 0;
+    config->compress = mCompress && (NANOHUB_COMPRESSIBLE & NANOHUB_HANDLE_BIT(handle));
+}
+
+/*
+ * sendConfig: hand one config to the hub, acknowledged when mAcked.
+ */
+int NanoHub::sendConfig(int handle, const void *config, size_t len)
+{
+    int err;
+
+    mConfigStale &= ~NANOHUB_HANDLE_BIT(handle);
+    if (mAcked) {
+        err = mTxn.submit(handle, config, len);
+    } else {
+        err = write_config(mDataFd, config, len);
+    }
+    if (err < 0) {
+        ALOGE("config write handle %d error:%d", handle, err);
+        mConfigStale |= NANOHUB_HANDLE_BIT(handle);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * writeConfig: send handle's current config. The flush and calibrate
+ * bits are one-shot requests, callers set them around the call.
+ */
+int NanoHub::writeConfig(int handle)
+{
+    struct sensor_config *config = &mSensorConfig[handle];
+
+    fillConfigHeader(handle, config);
+
+    return sendConfig(handle, config, sizeof(struct sensor_config));
+}
+
+int NanoHub::writeBias(int handle, const float bias[3])
+{
+    struct sensor_bias_config cal;
+
+    cal.config = mSensorConfig[handle];
+    fillConfigHeader(handle, &cal.config);
+    cal.config.flush = 0;
+    cal.config.calibrate = 0;
+    cal.config.setBias = 1;
+    memcpy(cal.bias, bias, sizeof(cal.bias));
+
+    return sendConfig(handle, &cal, sizeof(cal));
+}
+
+/*
+ * restoreCalibration: hand every stored bias back to the hub, pipelined;
+ * the caller collects the answers with completeConfig(). Until the hub
+ * reports biases of its own, these are the ones decoding uses. Called
+ * with mConfigLock held.
+ */
+void NanoHub::restoreCalibration(void)
+{
+    float bias[3];
+    int n = 0;
+
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        if (!(NANOHUB_CALIBRATABLE & NANOHUB_HANDLE_BIT(i)) || !mCalibration.get(i, bias)) {
+            continue;
+        }
+        memcpy(mBias[i].bias, bias, sizeof(mBias[i].bias));
+        mBias[i].valid = true;
+        if (writeBias(i, bias) == 0) {
+            n++;
+        }
+    }
+
+    if (n) {
+        ALOGI("calibration: %d biases restored", n);
+    }
+}
+
+/*
+ * requestCalibration: have the hub calibrate handle's sensor now; the
+ * result comes back as a bias slot in its samples. Called with
+ * mConfigLock held.
+ */
+int NanoHub::requestCalibration(int handle)
+{
+    struct sensor_config *config = &mSensorConfig[handle];
+    int err;
+
+    mCalRequested |= NANOHUB_HANDLE_BIT(handle);
+
+    config->calibrate = 1;
+    err = writeConfig(handle);
+    config->calibrate = 0;
+    if (!err) {
+        err = completeConfig();
+    }
+
+    return err;
+}
+
+/*
+ * completeConfig: wait until the hub answered every config written since
+ * the last call. Handles it refused are resent by the next updateHub().
+ * Called with mConfigLock held.
+ */
+int NanoHub::completeConfig(void)
+{
+    uint64_t failed;
+    int err;
+
+    if (!mAcked) {
+        return 0;
+    }
+    err = mTxn.complete(&failed);
+    __atomic_store_n(&mAcksOwed, false, __ATOMIC_RELEASE);
+    if (!err) {
+        return 0;
+    }
+
+    ALOGE("hub refused config for handles 0x%" PRIx64, failed);
+    mConfigStale |= failed;
+
+    return -1;
+}
+
+/*
+ * collectConfig: do the config work and settle the answers the poll
+ * thread left owing, without waiting on the hub, nor on a binder thread
+ * holding mConfigLock, which settles them itself. Runs on the poll
+ * thread.
+ */
+void NanoHub::collectConfig(void)
+{
+    uint64_t failed;
+
+    if (pthread_mutex_trylock(&mConfigLock)) {
+        return;
+    }
+    settleOwed();
+    if (mTxn.collect(&failed) < 0) {
+        ALOGE("hub refused config for handles 0x%" PRIx64, failed);
+        mConfigStale |= failed;
+    }
+    if (!mTxn.pending()) {
+        __atomic_store_n(&mAcksOwed, false, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mConfigLock);
+}
+
+/*
+ * updateHub: push the arbitrated config of every handle that a change to
+ * handle can affect, skipping the ones the hub already has. With wait,
+ * the hub's answers are collected before returning; the poll thread
+ * can't block on them and leaves them to syncConfig(). Called with
+ * mConfigLock held.
+ */
+int NanoHub::updateHub(int handle, bool wait)
+{
+    uint64_t mask = mArbiter.affected(handle);
+    struct sensor_config *config;
+    uint32_t rate;
+    uint64_t latency;
+    bool enable;
+    int err = 0;
+
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        if (!(mask & NANOHUB_HANDLE_BIT(i))) {
+            continue;
+        }
+
+        /* derived handles run at their stream's rate, as in streamOf() */
+        if (mArbiter.isHostFused(i) || NanoHubArbiter::getSource(i) != i) {
+            mRatePlan[i].hubRate = mRatePlan[streamOf(i)].hubRate;
+            updateDecimation(i);
+            continue;
+        }
+
+        config = &mSensorConfig[i];
+        enable = mArbiter.aggregate(i, &rate, &latency);
+        if (enable) {
+            rate = planRate(i, rate);
+            latency = mBatching.limit(latency);
+        } else {
+            rate = config->rate;
+            latency = config->latency;
+        }
+
+        mRatePlan[i].hubRate = rate;
+        updateDecimation(i);
+
+        /* only state seen while the stream runs is worth replaying */
+        if (!enable) {
+            __atomic_fetch_and(&mLastEventValid, ~NANOHUB_HANDLE_BIT(i), __ATOMIC_RELEASE);
+        }
+
+        if (config->enable == enable && config->rate == rate && config->latency == latency &&
+            !(mConfigStale & NANOHUB_HANDLE_BIT(i))) {
+            continue;
+        }
+
+        ALOGD("handle %d: enable %d hub rate %u latency %" PRIu64 ", keep 1/%u", i,
+              enable, rate, latency, mRatePlan[i].decimation);
+
+        config->enable = enable;
+        config->rate = rate;
+        config->latency = latency;
+        config->flush = 0;
+        if (writeConfig(i) < 0) {
+            err = -1;
+        }
+    }
+
+    /* every stream was written before waiting on any answer */
+    if (!wait) {
+        __atomic_store_n(&mAcksOwed, mAcked, __ATOMIC_RELEASE);
+    } else if (completeConfig() < 0) {
+        err = -1;
+    }
+
+    /* sources come first, so derived handles see their new latency */
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        if (mask & NANOHUB_HANDLE_BIT(i)) {
+            publishConfig(i);
+        }
+    }
+
+    return err;
+}
+
+/*
+ * flush: ask the hub to drain handle's stream. Streams it doesn't batch
+ * (event sensors with no latency) have nothing to drain and are
+ * completed locally, as is done once the decoded backlog is handed out.
+ */
+int NanoHub::flush(int client, int handle)
+{
+    int err;
+    int sensor_handle = handle_to_sensor_type(handle);
+    int source;
+    struct sensor_config *config;
+
+    if (sensor_handle < 0) {
+        return -1;
+    }
+    source = streamOf(handle);
+
+    lockConfig();
+
+    if (!mArbiter.isActive(client, handle) ||
+        mRatePlan[handle].reportingMode == SENSOR_FLAG_ONE_SHOT_MODE) {
+        pthread_mutex_unlock(&mConfigLock);
+        return -EINVAL;
+    }
+
+    config = &mSensorConfig[source];
+
+    if (config->latency == 0 && !mFlushes.pending(source) &&
+        mRatePlan[handle].reportingMode != SENSOR_FLAG_CONTINUOUS_MODE) {
+        mFlushes.pushLocal(handle, client);
+        pthread_mutex_unlock(&mConfigLock);
+        kickReader();
+        return 0;
+    }
+
+    ALOGD("Flush Handle:%d", handle);
+
+    if (mFlushes.push(source, handle, client) < 0) {
+        ALOGW("too many flushes outstanding on handle %d", source);
+        pthread_mutex_unlock(&mConfigLock);
+        return -EAGAIN;
+    }
+
+    config->flush = 1;
+    err = writeConfig(source);
+    config->flush = 0;
+    if (!err) {
+        err = completeConfig();
+    }
+    if (err) {
+        mFlushes.cancel(source);
+    }
+
+    pthread_mutex_unlock(&mConfigLock);
+
+    if (!err) {
+        kickReader();
+    }
+
+    return err;
+}
+
+int NanoHub::activate(int client, int handle, int enabled)
+{
+    int sensor_handle = handle_to_sensor_type(handle);
+    float bias[3];
+    int source;
+    int err;
+
+    if (sensor_handle < 0) {
+        return -1;
+    }
+
+    lockConfig();
+
+    if (enabled) {
+        mArbiter.request(client, handle);
+
+        /*
+         * Like sensorSendOneDirectEvt(): a new client of an on-change
+         * sensor gets the last known state right away instead of waiting
+         * for the hub to see a change.
+         */
+        if (mRatePlan[handle].reportingMode == SENSOR_FLAG_ON_CHANGE_MODE &&
+            (__atomic_load_n(&mLastEventValid, __ATOMIC_ACQUIRE) & NANOHUB_HANDLE_BIT(handle))) {
+            __atomic_fetch_or(&mDirectPending[client], NANOHUB_HANDLE_BIT(handle),
+                              __ATOMIC_RELEASE);
+        }
+    } else {
+        mArbiter.release(client, handle);
+    }
+
+    err = updateHub(handle, true);
+
+    /* nothing stored for the gyro yet: calibrate once it runs */
+    source = NanoHubArbiter::getSource(handle);
+    if (enabled && !err && (NANOHUB_AUTO_CALIBRATE & NANOHUB_HANDLE_BIT(source)) &&
+        mSensorConfig[source].enable && !(mCalRequested & NANOHUB_HANDLE_BIT(source)) &&
+        !mCalibration.get(source, bias)) {
+        requestCalibration(source);
+    }
+    pthread_mutex_unlock(&mConfigLock);
+
+    /* cached on-change state goes out without waiting for the hub */
+    if (enabled && !err) {
+        kickReader();
+    }
+
+    return err;
+}
+
+int NanoHub::batch(int client, int handle, int64_t sampling_period_ns,
+                   int64_t max_report_latency_ns)
+{
+    int sensor_handle = handle_to_sensor_type(handle);
+    struct sensor_rate_plan *plan;
+    int err;
+
+    if (sensor_handle < 0) {
+        return -1;
+    }
+
+    lockConfig();
+    mArbiter.requestRateChange(client, handle, wantedRate(handle, sampling_period_ns),
+                               max_report_latency_ns);
+    err = updateHub(handle, true);
+    plan = &mRatePlan[handle];
+    if (!err && !plan->fixedRate && plan->requestedRate &&
+        plan->deliveredRate != plan->requestedRate) {
+        ALOGI("handle %d: %.3f Hz asked for, delivering %.3f Hz (hub %.3f Hz 1/%u)", handle,
+              plan->requestedRate / 1024.0f, plan->deliveredRate / 1024.0f,
+              plan->hubRate / 1024.0f, plan->decimation);
+    }
+    pthread_mutex_unlock(&mConfigLock);
+
+    return err;
+}
+
+/*
+ * wifiSeen: true if bssid was already reported in the current scan window.
+ *
+ * Open addressing with linear probing over a small power of 2 table; a
+ * slot holds the 48-bit BSSID with bit 63 set, 0 is empty. The table is
+ * cleared when a window expires or gets 3/4 full.
+ */
+bool NanoHub::wifiSeen(const uint8_t *bssid, uint64_t time)
+{
+    uint64_t key = 1ULL << 63;
+    uint32_t slot;
+
+    for (int i = 0; i < WIFI_BSSID_LEN; i++) {
+        key |= (uint64_t)bssid[i] << (8 * i);
+    }
+
+    if (time - mWifiWindowStart > NANOHUB_WIFI_DEDUP_WINDOW ||
+        mWifiSeenCount >= NANOHUB_WIFI_DEDUP_SLOTS * 3 / 4) {
+        memset(mWifiSeen, 0, sizeof(mWifiSeen));
+        mWifiSeenCount = 0;
+        mWifiWindowStart = time;
+    }
+
+    slot = (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (NANOHUB_WIFI_DEDUP_SLOTS - 1);
+    while (mWifiSeen[slot]) {
+        if (mWifiSeen[slot] == key) {
+            return true;
+        }
+        slot = (slot + 1) & (NANOHUB_WIFI_DEDUP_SLOTS - 1);
+    }
+
+    mWifiSeen[slot] = key;
+    mWifiSeenCount++;
+
+    return false;
+}
+
+/*
+ * processWifiScan: decode a WifiScanEvent batch.
+ *
+ * Results sit unaligned in the packet (the 12 byte header puts the 64-bit
+ * fields off their natural alignment), so each one is copied whole into
+ * an aligned local before being unpacked into the event, avoiding any
+ * allocation or per-field unaligned access.
+ */
+int NanoHub::processWifiScan(sensors_event_t* data, const struct EvtPacket *eventPacket)
+{
+    struct WifiScanResult result;
+    struct nanohub_wifi_scan_event *scan;
+    struct SensorFirstSample first;
+    uint64_t time = 0;
+    int numResults, num_events = 0;
+    int i;
+
+    static_assert(sizeof(struct nanohub_wifi_scan_event) <= sizeof(data->data),
+                  "wifi scan result doesn't fit in sensors_event_t");
+
+    memcpy(&first, eventPacket->buffer, sizeof(first));
+    numResults = min(first.numSamples,
+                     (int)(NANOHUB_SENSOR_DATA_MAX / sizeof(struct WifiScanResult)));
+
+    for (i = 0; i < numResults; i++) {
+        memcpy(&result, &eventPacket->buffer[i * sizeof(result)], sizeof(result));
+
+        if (i == 0) {
+            time = eventPacket->referenceTime;
+        } else {
+            time += result.deltaTime;
+        }
+
+        if (wifiSeen(result.bssid, time)) {
+            continue;
+        }
+
+        memset(data, 0, sizeof(*data));
+        data->version = sizeof(sensors_event_t);
+        data->sensor = NANOHUB_WIFI;
+        data->type = SENSOR_TYPE_NANOHUB_WIFI_SCAN;
+        data->timestamp = time;
+
+        scan = (struct nanohub_wifi_scan_event *)data->data;
+        memcpy(scan->bssid, result.bssid, WIFI_BSSID_LEN);
+        scan->rssi = result.rssi;
+        scan->band = result.band;
+        scan->channelIndex = result.channelIndex;
+        scan->channelWidth = result.channelWidth;
+        scan->centerFreqIndex0 = result.centerFreqIndex0;
+        scan->centerFreqIndex1 = result.centerFreqIndex1;
+        scan->flags = result.flags;
+        scan->rtt = result.rtt;
+        scan->rttStd = result.rttStd;
+        memcpy(scan->ssid, result.ssid, WIFI_MAX_SSID_LEN);
+        scan->ssid[WIFI_MAX_SSID_LEN - 1] = '\0';
+
+        data++;
+        num_events++;
+    }
+
+    return num_events + processFlushes(data, NANOHUB_WIFI, first.numFlushes);
+}
+
+int NanoHub::processFlushes(sensors_event_t* data, int sensor_id, int numFlushes)
+{
+    int client;
+
+    for (int i = 0; i < numFlushes; i++) {
+        data->version = META_DATA_VERSION;
+        data->sensor = 0;
+        data->type = SENSOR_TYPE_META_DATA;
+        data->timestamp = 0;
+        data->meta_data.what = META_DATA_FLUSH_COMPLETE;
+        data->meta_data.sensor = mFlushes.pop(sensor_id, &client);
+        data->reserved0 = client >= 0 ? client + 1 : 0;
+        data++;
+    }
+
+    return numFlushes;
+}
+
+/*
+ * acceptSample: reporting mode rules for a decoded non-continuous sample.
+ *
+ * On-change sensors only report values that differ from the last one
+ * reported; one-shot sensors disarm themselves once they fire.
+ */
+bool NanoHub::acceptSample(const sensors_event_t* data)
+{
+    int handle = data->sensor;
+    uint64_t bit = NANOHUB_HANDLE_BIT(handle);
+
+    switch (mRatePlan[handle].reportingMode) {
+        case SENSOR_FLAG_ON_CHANGE_MODE:
+            if ((mLastEventValid & bit) &&
+                !memcmp(mLastEvent[handle].u64.data, data->u64.data, sizeof(data->u64.data))) {
+                return false;
+            }
+            mLastEvent[handle] = *data;
+            __atomic_fetch_or(&mLastEventValid, bit, __ATOMIC_RELEASE);
+            break;
+        case SENSOR_FLAG_ONE_SHOT_MODE:
+            /* fired already, the disarm is owed to the next lock holder */
+            if (__atomic_fetch_or(&mDisarmOwed, bit, __ATOMIC_ACQ_REL) & bit) {
+                return false;
+            }
+            collectConfig();
+            break;
+    }
+
+    return true;
+}
+
+/*
+ * fillSample: encode one scalar hub sample the way its Android type wants
+ * it. fvalue and ivalue are the same sample seen as float and as integer.
+ */
+void NanoHub::fillSample(sensors_event_t* data, int sensor_id, uint64_t time,
+                         float fvalue, uint32_t ivalue)
+{
+    memset(data, 0, sizeof(*data));
+    data->version = sizeof(sensors_event_t);
+    data->sensor = sensor_id;
+    data->type = handle_to_sensor_type(sensor_id);
+    data->timestamp = time;
+
+    switch (data->type) {
+        case SENSOR_TYPE_STEP_COUNTER:
+            data->u64.step_counter = ivalue;
+            break;
+        case SENSOR_TYPE_HEART_RATE:
+            data->heart_rate.bpm = fvalue;
+            data->heart_rate.status = fvalue > 0.0f ?
+                SENSOR_STATUS_ACCURACY_HIGH : SENSOR_STATUS_NO_CONTACT;
+            break;
+        case SENSOR_TYPE_STEP_DETECTOR:
+        case SENSOR_TYPE_SIGNIFICANT_MOTION:
+        case SENSOR_TYPE_TILT_DETECTOR:
+            data->data[0] = 1.0f;
+            break;
+        default:
+            /* pressure, light, distance, temperature and private types */
+            data->data[0] = fvalue;
+            break;
+    }
+}
+
+int NanoHub::processTriple(sensors_event_t* data, uint64_t referenceTime,
+                           const struct TripleAxisDataPoint *samples, int numSamples, int sensor_id)
+{
+    int i, j;
+    uint64_t lastTime = 0;
+    int sensor_type = handle_to_sensor_type(sensor_id);
+    int uncal_id;
+    int num_events = 0;
+    bool deliver, deliverUncal, fuse;
+    int8_t status;
+    int n;
+    float sample[3], cal[3], uncal[3];
+    struct SensorFirstSample first;
+    struct sensor_bias *bias;
+
+    first = samples[0].firstSample;
+    bias = &mBias[sensor_id];
+    uncal_id = NanoHubArbiter::getAlias(sensor_id);
+    deliver = isStreaming(sensor_id);
+    deliverUncal = uncal_id >= 0 && isStreaming(uncal_id);
+    fuse = mFusion.wants(sensor_id);
+
+    for (i = 0; i < numSamples; i++) {
+
+        if (i == 0) {
+            lastTime = referenceTime;
+        } else {
+            lastTime += samples[i].deltaTime;
+        }
+
+        sample[0] = samples[i].x;
+        sample[1] = samples[i].y;
+        sample[2] = samples[i].z;
+
+        /* One slot of the batch may carry the new bias instead of data */
+        if (first.biasPresent && first.biasSample == i) {
+            memcpy(bias->bias, sample, sizeof(sample));
+            bias->valid = true;
+            mCalibration.update(sensor_id, sample, lastTime);
+            continue;
+        }
+
+        /*
+         * biasCurrent: the hub already took the bias out. Otherwise the
+         * sample is raw and we correct it ourselves, once we know the bias.
+         */
+        for (j = 0; j < 3; j++) {
+            if (!bias->valid) {
+                cal[j] = uncal[j] = sample[j];
+            } else if (first.biasCurrent) {
+                cal[j] = sample[j];
+                uncal[j] = sample[j] + bias->bias[j];
+            } else {
+                cal[j] = sample[j] - bias->bias[j];
+                uncal[j] = sample[j];
+            }
+        }
+
+        status = (uncal_id >= 0 && !bias->valid) ?
+            SENSOR_STATUS_ACCURACY_LOW : SENSOR_STATUS_ACCURACY_HIGH;
+
+        if (deliver) {
+            memset(data, 0, sizeof(*data));
+            data->timestamp = lastTime;
+
+            data->version = sizeof(sensors_event_t);
+            data->sensor = sensor_id;
+            data->type = sensor_type;
+            data->acceleration.status = status;
+            data->acceleration.x = cal[0];
+            data->acceleration.y = cal[1];
+            data->acceleration.z = cal[2];
+            data++;
+            num_events++;
+        }
+
+        if (deliverUncal) {
+            memset(data, 0, sizeof(*data));
+            data->timestamp = lastTime;
+
+            data->version = sizeof(sensors_event_t);
+            data->sensor = uncal_id;
+            data->type = handle_to_sensor_type(uncal_id);
+            memcpy(data->uncalibrated_gyro.uncalib, uncal, sizeof(uncal));
+            if (bias->valid) {
+                memcpy(data->uncalibrated_gyro.bias, bias->bias, sizeof(bias->bias));
+            } else {
+                memset(data->uncalibrated_gyro.bias, 0, sizeof(bias->bias));
+            }
+            data++;
+            num_events++;
+        }
+
+        if (fuse) {
+            n = mFusion.process(sensor_id, lastTime, cal, data);
+            data += n;
+            num_events += n;
+        }
+    }
+
+    return num_events + processFlushes(data, sensor_id, first.numFlushes);
+}
+
+/*
+ * processCompressed: widen a compressed triple axis packet back into
+ * TripleAxisDataPoints and decode those. The loop is branch free over
+ * plain int16s, so it vectorizes to widen, convert and scale. A packet
+ * whose delta shift doesn't fit a 32 bit delta is corrupt and dropped.
+ */
+int NanoHub::processCompressed(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id)
+{
+    const struct TripleAxisCompressedDataPoint *in;
+    struct TripleAxisCompressedHeader header;
+    struct TripleAxisDataPoint *out = mExpanded;
+    int numSamples;
+    float scale;
+    int i;
+
+    memcpy(&header, eventPacket->buffer, sizeof(header));
+    if (header.deltaShift >= 32) {
+        ALOGW("bad compressed packet for handle %d: delta shift %u", sensor_id,
+              header.deltaShift);
+        return 0;
+    }
+    in = (const struct TripleAxisCompressedDataPoint *)&eventPacket->buffer[sizeof(header)];
+    numSamples = min(header.firstSample.numSamples, (int)NANOHUB_COMPRESSED_SAMPLES_MAX);
+    scale = header.scale;
+
+    for (i = 0; i < numSamples; i++) {
+        out[i].deltaTime = (uint32_t)in[i].deltaTime << header.deltaShift;
+        out[i].x = in[i].x * scale;
+        out[i].y = in[i].y * scale;
+        out[i].z = in[i].z * scale;
+    }
+    out[0].firstSample = header.firstSample;
+
+    return processTriple(data, eventPacket->referenceTime, out, numSamples, sensor_id);
+}
+
+/*
+ * processRotation: rotation vector samples. The hub sends the vector part
+ * of a unit quaternion with w >= 0; w is rebuilt and the whole normalized
+ * again, rounding in the packet would otherwise accumulate in w. Heading
+ * accuracy isn't carried, so it is reported as unknown.
+ *
+ * Orientation is decoded from the same stream: the Euler angles come out
+ * of the quaternion while it is at hand.
+ */
+int NanoHub::processRotation(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id)
+{
+    int i;
+    uint64_t lastTime = 0;
+    int sensor_type = handle_to_sensor_type(sensor_id);
+    int numSamples;
+    int num_events = 0;
+    bool deliver, deliverOrien;
+    float q[4], R[9], n;
+    const struct TripleAxisDataPoint *samples = eventPacket->triple;
+    struct SensorFirstSample first;
+
+    first = samples[0].firstSample;
+    numSamples = min(first.numSamples,
+                     (int)(NANOHUB_SENSOR_DATA_MAX / sizeof(struct TripleAxisDataPoint)));
+
+    deliver = isStreaming(sensor_id);
+    deliverOrien = sensor_id == NANOHUB_RV && isStreaming(NANOHUB_ORIEN);
+
+    for (i = 0; i < numSamples; i++) {
+
+        if (i == 0) {
+            lastTime = eventPacket->referenceTime;
+        } else {
+            lastTime += samples[i].deltaTime;
+        }
+
+        q[0] = samples[i].x;
+        q[1] = samples[i].y;
+        q[2] = samples[i].z;
+        n = 1.0f - (q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+        q[3] = n > 0.0f ? n * inv_sqrt(n) : 0.0f;
+        if (!quat_normalize(q)) {
+            continue;
+        }
+
+        if (deliver) {
+            memset(data, 0, sizeof(*data));
+            data->version = sizeof(sensors_event_t);
+            data->sensor = sensor_id;
+            data->type = sensor_type;
+            data->timestamp = lastTime;
+            memcpy(data->data, q, sizeof(q));
+            if (sensor_id != NANOHUB_GAMERV) {
+                data->data[4] = -1.0f;
+            }
+            data++;
+            num_events++;
+        }
+
+        if (deliverOrien) {
+            memset(data, 0, sizeof(*data));
+            data->version = sizeof(sensors_event_t);
+            data->sensor = NANOHUB_ORIEN;
+            data->type = SENSOR_TYPE_ORIENTATION;
+            data->timestamp = lastTime;
+            quat_to_matrix(q, R);
+            matrix_to_orientation(R, data->data);
+            data->orientation.status = SENSOR_STATUS_ACCURACY_HIGH;
+            data++;
+            num_events++;
+        }
+    }
+
+    return num_events + processFlushes(data, sensor_id, first.numFlushes);
+}
+
+int NanoHub::processSingle(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id)
+{
+    int i;
+    uint64_t lastTime = 0;
+    int numSamples;
+    int num_events = 0;
+    bool deliver = isStreaming(sensor_id);
+    const struct SingleAxisDataPoint *samples = eventPacket->single;
+    struct SensorFirstSample first;
+
+    first = samples[0].firstSample;
+    numSamples = min(first.numSamples,
+                     (int)(NANOHUB_SENSOR_DATA_MAX / sizeof(struct SingleAxisDataPoint)));
+
+    for (i = 0; i < numSamples; i++) {
+
+        if (i == 0) {
+            lastTime = eventPacket->referenceTime;
+        } else {
+            lastTime += samples[i].deltaTime;
+        }
+
+        if (!deliver) {
+            continue;
+        }
+
+        fillSample(data, sensor_id, lastTime, samples[i].fdata, samples[i].idata);
+        if (acceptSample(data)) {
+            data++;
+            num_events++;
+        }
+    }
+
+    return num_events + processFlushes(data, sensor_id, first.numFlushes);
+}
+
+/*
+ * processEmbedded: the whole event is one 32-bit value with no timestamp
+ * of its own, so it is stamped on arrival.
+ */
+int NanoHub::processEmbedded(sensors_event_t* data, const struct NanohubReadEventResponse *event, int sensor_id)
+{
+    union EmbeddedDataPoint value;
+
+    if (!isStreaming(sensor_id)) {
+        return 0;
+    }
+
+    memcpy(&value.idata, event->evtData, sizeof(value.idata));
+    fillSample(data, sensor_id, systemTime(SYSTEM_TIME_BOOTTIME), (float)value.idata, value.idata);
+
+    return acceptSample(data) ? 1 : 0;
+}
+
+int NanoHub::processEvent(sensors_event_t* data, const struct NanohubReadEventResponse *event)
+{
+    const struct EvtPacket *eventPacket = (const struct EvtPacket *)event;
+    int nanohub_type;
+    int sensor_id;
+
+    /* the sensors app starts when the hub boots; whatever it ran is gone */
+    if (eventPacket->sensType == EVT_APP_START) {
+        ALOGW("hub reset");
+        mResetPending = true;
+        return 0;
+    }
+
+    nanohub_type = 0x0ff & eventPacket->sensType;
+
+    sensor_id = nanohub_type_to_handle(nanohub_type);
+    if (handle_to_sensor_type(sensor_id) < 0) {
+        return 0;
+    }
+
+    if ((eventPacket->sensType & ~0x0ff) == EVT_NO_FIRST_COMPRESSED_SENSOR_EVENT) {
+        if (handle_to_num_axis(sensor_id) != NUM_AXIS_THREE) {
+            return 0;
+        }
+        return processCompressed(data, eventPacket, sensor_id);
+    }
+
+    switch (sensor_id) {
+        case NANOHUB_RV:
+        case NANOHUB_GAMERV:
+        case NANOHUB_GEORV:
+            return processRotation(data, eventPacket, sensor_id);
+    }
+
+    switch (handle_to_num_axis(sensor_id)) {
+        case NUM_AXIS_WIFI:
+            return processWifiScan(data, eventPacket);
+        case NUM_AXIS_EMBEDDED:
+            return processEmbedded(data, event, sensor_id);
+        case NUM_AXIS_ONE:
+            return processSingle(data, eventPacket, sensor_id);
+        default:
+            return processTriple(data, eventPacket->referenceTime, eventPacket->triple,
+                                 min(eventPacket->firstSample.numSamples,
+                                     (int)(NANOHUB_SENSOR_DATA_MAX /
+                                           sizeof(struct TripleAxisDataPoint))),
+                                 sensor_id);
+    }
+}
+
+bool NanoHub::directPending(void) const
+{
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (__atomic_load_n(&mDirectPending[c], __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * sendDirectEvents: replay the cached state of the on-change sensors
+ * activate() queued, stamped now, to the client that enabled them only.
+ * Whatever doesn't fit stays queued.
+ */
+int NanoHub::sendDirectEvents(sensors_event_t* data, int count)
+{
+    int64_t now = systemTime(SYSTEM_TIME_BOOTTIME);
+    int handle, num_events = 0;
+    uint64_t pending;
+
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        pending = __atomic_exchange_n(&mDirectPending[c], 0, __ATOMIC_ACQ_REL);
+
+        while (pending && num_events < count) {
+            handle = __builtin_ctzll(pending);
+            pending &= pending - 1;
+
+            data[num_events] = mLastEvent[handle];
+            data[num_events].timestamp = now;
+            data[num_events].reserved0 = c + 1;
+            num_events++;
+        }
+
+        if (pending) {
+            __atomic_fetch_or(&mDirectPending[c], pending, __ATOMIC_RELEASE);
+        }
+    }
+
+    return num_events;
+}
+
+/*
+ * decodeBatch: fill a fresh arena batch with the next events to hand
+ * out: cached on-change state first, then local flush completions, else
+ * one packet read from the hub, decoded and decimated in place.
+ *
+ * A packet can decode to more events than a caller has room for (a
+ * sample can yield both calibrated and uncalibrated events, and flush
+ * completions pile up), which is why whole packets go to a batch.
+ * Returns -EAGAIN when the hub has nothing to read.
+ */
+int NanoHub::decodeBatch(struct nanohub_batch *batch)
+{
+    sensors_event_t *events;
+    int64_t start;
+    int rc;
+
+    if (mArena.alloc(batch) < 0) {
+        return -ENOMEM;
+    }
+    events = mArena.events(batch);
+
+    if (directPending()) {
+        rc = sendDirectEvents(events, NANOHUB_DECODE_MAX);
+    } else if (mFlushes.hasLocal()) {
+        rc = mFlushes.popLocal(events, NANOHUB_DECODE_MAX);
+    } else if (__atomic_load_n(&mReopenOwed, __ATOMIC_ACQUIRE) && recover(false) < 0) {
+        /* the hub is gone until the next reopen attempt */
+        mArena.release(batch);
+        return -EAGAIN;
+    } else {
+        start = NanoHubTrace::begin(NANOHUB_TRACE_READ);
+        rc = read(mDataFd, &mEvents, sizeof(struct NanohubReadEventResponse));
+        NanoHubTrace::end(NANOHUB_TRACE_READ, start, -1, 0, 0);
+        if (rc < 0) {
+            rc = -errno;
+            mArena.release(batch);
+            if (rc == -EAGAIN || rc == -EINTR) {
+                return -EAGAIN;
+            }
+            ALOGE("rc %d while reading ring\n", rc);
+            return recover(true);
+        }
+        mReopenDelay = NANOHUB_REOPEN_MIN_MS;
+
+        syncConfig();
+        mBatching.decoded(packet_samples((const struct EvtPacket *)&mEvents));
+        start = NanoHubTrace::begin(NANOHUB_TRACE_DECODE);
+        rc = processEvent(events, &mEvents);
+        if (start) {
+            NanoHubTrace::end(NANOHUB_TRACE_DECODE, start, rc > 0 ? events[0].sensor : -1, rc,
+                              rc > 0 ? events[0].timestamp : 0);
+        }
+        if (mResetPending) {
+            mResetPending = false;
+            recover(false);
+        }
+        if (rc > 0 && events[rc - 1].type != SENSOR_TYPE_META_DATA) {
+            mSpin.delivered(events[rc - 1].timestamp);
+        }
+        mGaps.process(events, rc);
+        rc = mDecimator.process(events, rc, NANOHUB_DECODE_MAX);
+    }
+
+    if (rc <= 0) {
+        mArena.release(batch);
+        return rc;
+    }
+    mArena.commit(batch, rc);
+
+    return rc;
+}
+
+/*
+ * reopen: one attempt at getting a working /dev/nanohub back after an
+ * error, once the last attempt's backoff has run out. A failure doubles
+ * the backoff, which only goes back down once the hub is read again, so
+ * a device that opens but keeps failing isn't reopened in a loop. The
+ * new file takes over the old descriptor number, so poll sets built
+ * around getFd() stay valid. Called with mReadLock held.
+ */
+int NanoHub::reopen(void)
+{
+    int64_t now = systemTime(SYSTEM_TIME_BOOTTIME);
+    int fd;
+
+    if (now < mReopenDue) {
+        return -EIO;
+    }
+
+    fd = open(NANOHUB_DEV_PATH, O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        ALOGW("reopen '%s' failed: %s, retry in %u ms", NANOHUB_DEV_PATH, strerror(errno),
+              mReopenDelay);
+        __atomic_store_n(&mReopenDue, now + mReopenDelay * 1000000LL, __ATOMIC_RELEASE);
+        if (mReopenDelay < NANOHUB_REOPEN_MAX_MS) {
+            mReopenDelay *= 2;
+        }
+        return -EIO;
+    }
+
+    /* dup2() swaps the file under binder threads' writes atomically */
+    if (__atomic_load_n(&mDataFd, __ATOMIC_ACQUIRE) < 0) {
+        __atomic_store_n(&mDataFd, fd, __ATOMIC_RELEASE);
+    } else if (fd != mDataFd) {
+        dup2(fd, mDataFd);
+        close(fd);
+    }
+    __atomic_store_n(&mReopenOwed, false, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * retryReopen: make the reopen attempt recover() left owing, unless a
+ * read is under way, which makes it itself. Runs on the poll thread.
+ */
+void NanoHub::retryReopen(void)
+{
+    if (pthread_mutex_trylock(&mReadLock)) {
+        return;
+    }
+    if (__atomic_load_n(&mReopenOwed, __ATOMIC_ACQUIRE)) {
+        recover(false);
+    }
+    pthread_mutex_unlock(&mReadLock);
+}
+
+/*
+ * replayConfig: resend the stored biases and every stream the hub should
+ * be running back to back, after it lost its state. The answers are left
+ * to the caller's completeConfig() or to syncConfig(). Called with
+ * mConfigLock held, through settleOwed().
+ */
+void NanoHub::replayConfig(void)
+{
+    int64_t start = systemTime(SYSTEM_TIME_BOOTTIME);
+    int n = 0;
+
+    restoreCalibration();
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        if (streamOf(i) == i && mSensorConfig[i].enable) {
+            mSensorConfig[i].flush = 0;
+            writeConfig(i);
+            n++;
+        }
+    }
+    __atomic_store_n(&mAcksOwed, mAcked, __ATOMIC_RELEASE);
+
+    ALOGI("hub reset: %d streams resent in %" PRId64 " us", n,
+          (systemTime(SYSTEM_TIME_BOOTTIME) - start) / 1000);
+}
+
+/*
+ * recover: bring the hub back to the configuration the framework set up,
+ * reopening the device first if reading it failed or a reopen is still
+ * owed. Flushes the hub had outstanding are completed locally. Returns
+ * -EIO while the device can't be reopened; wait() retries it. Called
+ * with mReadLock held.
+ */
+int NanoHub::recover(bool reopenFd)
+{
+    if (__atomic_load_n(&mClosing, __ATOMIC_ACQUIRE)) {
+        return -EIO;
+    }
+
+    if (reopenFd) {
+        __atomic_store_n(&mReopenOwed, true, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(&mReopenOwed, __ATOMIC_ACQUIRE) && reopen() < 0) {
+        return -EIO;
+    }
+
+    mFlushes.abandon();
+    __atomic_store_n(&mReplayOwed, true, __ATOMIC_RELEASE);
+    collectConfig();
+
+    return 0;
+}
+
+/*
+ * copyEvents: hand out decoded events, decoding the next batch when
+ * nothing is left over from the previous one. The only client gets
+ * everything, with the fan-out tags cleared. Called with mReadLock held.
+ */
+int NanoHub::copyEvents(sensors_event_t* data, int count)
+{
+    int rc, n = 0;
+
+    /*
+     * The hub fd is nonblocking: read until it runs dry (-EAGAIN) or the
+     * caller's buffer is full, so a stale POLLIN costs one read() at most
+     * and never blocks, and a short return tells the caller it drained
+     * everything.
+     */
+    while (n < count) {
+        if (!mBatch.count) {
+            mArena.release(&mBatch);
+            rc = decodeBatch(&mBatch);
+            if (rc == -EAGAIN) {
+                break;
+            } else if (rc < 0 && !n) {
+                return rc;
+            } else if (rc < 0) {
+                break;
+            }
+        }
+
+        n += mArena.copyOut(&mBatch, &data[n], count - n);
+    }
+
+    for (int i = 0; i < n; i++) {
+        data[i].reserved0 = 0;
+    }
+
+    return n;
+}
+
+/*
+ * getPollFd: what client's poll thread waits on, the hub itself or, once
+ * the reader runs, the client's queue.
+ */
+int NanoHub::getPollFd(int client) const
+{
+    NanoHubReader *reader = getReader();
+
+    return reader ? reader->getFd(client) : mDataFd;
+}
+
+bool NanoHub::hasPending(int client) const
+{
+    NanoHubReader *reader = getReader();
+
+    return reader ? reader->hasPending(client) : hasPending();
+}
+
+/*
+ * readEvents: client's events, from its queue once the reader runs,
+ * else read inline. Nothing once the client is detaching.
+ */
+int NanoHub::readEvents(int client, sensors_event_t* data, int count)
+{
+    NanoHubReader *reader;
+    int n = 0;
+
+    if (count < 1) {
+        return -EINVAL;
+    }
+
+    if (__atomic_load_n(&mDetaching[client], __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+
+    reader = getReader();
+    if (reader) {
+        return reader->readEvents(client, data, count);
+    }
+
+    pthread_mutex_lock(&mReadLock);
+    if (!__atomic_load_n(&mClosing, __ATOMIC_ACQUIRE) && !getReader()) {
+        n = copyEvents(data, count);
+    }
+    pthread_mutex_unlock(&mReadLock);
+
+    return n;
+}
+
+/*
+ * wait: client's poll(). Once the reader runs, the spin and batching
+ * state are its own and the client gets a plain poll(); a client that
+ * raced with its start may still spin once. Returns 0 right away once
+ * the client is detaching.
+ */
+int NanoHub::wait(int client, struct pollfd *fds, int nfds, int hubIdx, int timeoutMs)
+{
+    if (__atomic_load_n(&mDetaching[client], __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+
+    if (getReader()) {
+        return poll(fds, nfds, timeoutMs);
+    }
+
+    return wait(fds, nfds, hubIdx, timeoutMs);
+}
+
+/*
+ * takeBatch: hand the next decoded batch over to the caller, who then
+ * owns its reference; no events are copied.
+ */
+int NanoHub::takeBatch(struct nanohub_batch *batch)
+{
+    int rc;
+
+    pthread_mutex_lock(&mReadLock);
+    if (__atomic_load_n(&mClosing, __ATOMIC_ACQUIRE)) {
+        batch->block = -1;
+        batch->count = 0;
+        rc = 0;
+    } else if (mBatch.count) {
+        *batch = mBatch;
+        mBatch.block = -1;
+        mBatch.count = 0;
+        rc = batch->count;
+    } else {
+        mArena.release(&mBatch);
+        rc = decodeBatch(batch);
+    }
+    pthread_mutex_unlock(&mReadLock);
 
     return rc;
 }
@@ -18,6 +18,7 @@
 #define NANOHUB_H
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
@@ -25,29 +26,76 @@
 
 #include <hardware/sensors.h>
 #include "nanohubPacket.h"
+#include "nanohub_arena.h"
+#include "nanohub_arbiter.h"
+#include "nanohub_batching.h"
+#include "nanohub_cal.h"
+#include "nanohub_config.h"
+#include "nanohub_decimator.h"
+#include "nanohub_flush.h"
+#include "nanohub_fusion.h"
+#include "nanohub_gaps.h"
+#include "nanohub_handles.h"
 #include "nanohub_sensors.h"
+#include "nanohub_spin.h"
+#include "nanohub_trace.h"
+#include "nanohub_txn.h"
 
 #define READ_QUEUE_DEPTH 10
 
+#define NANOHUB_DEV_PATH            "/dev/nanohub"
+#define NANOHUB_REOPEN_MIN_MS       1       /* first retry after a hub reset */
+#define NANOHUB_REOPEN_MAX_MS       512     /* backoff cap */
+#define NANOHUB_WRITE_TIMEOUT_MS    100     /* wait for room in the hub's queue */
+#define NANOHUB_DETACH_WAIT_US      1000    /* recheck a detaching client's poll thread */
+#define NANOHUB_OWED_RETRY_MS       10      /* poll thread retries owed config work */
+#define NANOHUB_RATE_MULTIPLE_MAX   4       /* hub/client rate ratio worth an exact decimation */
+
+/* written to a client's wake fd to get its poll() to look again */
+#define NANOHUB_WAKE_MESSAGE        'W'
+
+/* worst case events one packet decodes to: doubled samples plus flushes */
+#define NANOHUB_DECODE_MAX NANOHUB_ARENA_BLOCK_EVENTS
+
+/* Streams the hub is asked to send compressed */
+#define NANOHUB_COMPRESSIBLE (NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | \
+                              NANOHUB_HANDLE_BIT(NANOHUB_GYRO) | \
+                              NANOHUB_HANDLE_BIT(NANOHUB_MAG))
+#define NANOHUB_COMPRESSED_SAMPLES_MAX \
+    ((NANOHUB_SENSOR_DATA_MAX - sizeof(struct TripleAxisCompressedHeader)) / \
+     sizeof(struct TripleAxisCompressedDataPoint))
+
 #define CROS_EC_EVENT_FLUSH_FLAG 0x1
 #define CROS_EC_EVENT_WAKEUP_FLAG 0x2
 
-/*****************************************************************************/
+#define SENSOR_STRING_TYPE_NANOHUB_WIFI_SCAN      "com.google.sensor.wifi_scan"
+#define SENSOR_STRING_TYPE_NANOHUB_ANY_MOTION     "com.google.sensor.any_motion"
+#define SENSOR_STRING_TYPE_NANOHUB_NO_MOTION      "com.google.sensor.no_motion"
+#define SENSOR_STRING_TYPE_NANOHUB_FLAT           "com.google.sensor.flat"
+#define SENSOR_STRING_TYPE_NANOHUB_GESTURE        "com.google.sensor.gesture"
+#define SENSOR_STRING_TYPE_NANOHUB_DOUBLE_TWIST   "com.google.sensor.double_twist"
+#define SENSOR_STRING_TYPE_NANOHUB_DOUBLE_TAP     "com.google.sensor.double_tap"
+#define SENSOR_STRING_TYPE_NANOHUB_WIN_ORIENTATION "com.google.sensor.window_orientation"
+#define SENSOR_STRING_TYPE_NANOHUB_HALL           "com.google.sensor.hall"
+#define SENSOR_STRING_TYPE_NANOHUB_ACTIVITY       "com.google.sensor.activity"
+#define SENSOR_STRING_TYPE_NANOHUB_VSYNC          "com.google.sensor.vsync"
 
-enum nanohub_sensor_id {
-    NANOHUB_ACCEL,
-    NANOHUB_GYRO,
-    NANOHUB_MAG,
-    NANOHUB_ORIEN,
-    NANOHUB_RV,
-    NANOHUB_LA,
-    NANOHUB_GRAV,
-    NANOHUB_GAMERV,
-    NANOHUB_GEORV,
-    NANOHUB_SD,
-    NANOHUB_SC,
-    NANOHUB_ID_MAX,
-};
+#define SENSOR_TYPE_NANOHUB_WIFI_SCAN       (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 1)
+#define SENSOR_TYPE_NANOHUB_ANY_MOTION      (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 2)
+#define SENSOR_TYPE_NANOHUB_NO_MOTION       (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 3)
+#define SENSOR_TYPE_NANOHUB_FLAT            (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 4)
+#define SENSOR_TYPE_NANOHUB_GESTURE         (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 5)
+#define SENSOR_TYPE_NANOHUB_DOUBLE_TWIST    (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 6)
+#define SENSOR_TYPE_NANOHUB_DOUBLE_TAP      (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 7)
+#define SENSOR_TYPE_NANOHUB_WIN_ORIENTATION (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 8)
+#define SENSOR_TYPE_NANOHUB_HALL            (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 9)
+#define SENSOR_TYPE_NANOHUB_ACTIVITY        (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 10)
+#define SENSOR_TYPE_NANOHUB_VSYNC           (SENSOR_TYPE_DEVICE_PRIVATE_BASE + 11)
+
+#define NANOHUB_WIFI_DEDUP_SLOTS    64          /* power of 2 */
+#define NANOHUB_WIFI_DEDUP_WINDOW   1000000000LL /* ns */
+
+/*****************************************************************************/
 
 struct sensor_config
 {
@@ -62,12 +110,73 @@ struct sensor_config
             uint8_t enable : 1;
             uint8_t flush : 1;
             uint8_t calibrate : 1;
-            uint8_t reserved : 5;
+            uint8_t compress : 1;   /* hub may send TripleAxisCompressed */
+            uint8_t setBias : 1;    /* a struct sensor_bias_config */
+            uint8_t reserved : 3;
         };
         uint8_t flags;
     };
 } __attribute__((packed));
 
+/*
+ * A stored bias handed back to the hub. The config part repeats what the
+ * stream is already set to, so firmware that doesn't know setBias just
+ * reapplies it.
+ */
+struct sensor_bias_config
+{
+    struct sensor_config config;
+    float bias[3];
+} __attribute__((packed));
+
+/*
+ * One WiFi scan result as delivered in sensors_event_t.data, which is
+ * 64 bytes. The SSID is NUL terminated.
+ */
+struct nanohub_wifi_scan_event
+{
+    uint8_t bssid[WIFI_BSSID_LEN];
+    int8_t rssi;
+    uint8_t band;
+    uint8_t channelIndex;
+    uint8_t channelWidth;
+    uint8_t centerFreqIndex0;
+    uint8_t centerFreqIndex1;
+    uint8_t flags;
+    uint64_t rtt;
+    uint64_t rttStd;
+    char ssid[WIFI_MAX_SSID_LEN];
+} __attribute__((packed));
+
+/*
+ * Last bias the hub reported for a sensor, from the bias slot of a
+ * SensorFirstSample batch.
+ */
+struct sensor_bias
+{
+    float bias[3];
+    bool valid;
+};
+
+/*
+ * Per-handle rate plan: what the framework asked for, what the hub can do
+ * and how many hub samples to drop on the host to get back to the former.
+ * All rates are in the hub's samples-per-1024s unit.
+ */
+struct sensor_rate_plan
+{
+    uint32_t rates[NANOHUB_SENSOR_INFO_RATES_MAX]; /* supported, ascending */
+    uint8_t numRates;
+    uint32_t fixedRate;     /* SENSOR_RATE_ONCHANGE etc. for non-continuous */
+    uint32_t reportingMode; /* SENSOR_FLAG_*_MODE */
+    uint32_t minRate;       /* from sensor_t.maxDelay, 0 if unbounded */
+    uint32_t maxRate;       /* from sensor_t.minDelay, 0 if unbounded */
+    uint32_t requestedRate; /* fastest client's, from the arbiter */
+    uint32_t hubRate;       /* what the hub runs, for all clients */
+    uint32_t decimation;
+    uint32_t deliveredRate; /* hubRate / decimation, what clients get */
+};
+
 struct EvtPacket
 {
     uint32_t sensType;
@@ -82,21 +191,169 @@ struct EvtPacket
     };
 } __attribute__((packed));
 
+class NanoHubReader;
+
+/*
+ * NanoHub: the hub as seen by the HAL. There is one per process, shared
+ * by every open of the HAL (acquire()/put()); each open attaches as a
+ * client with its own enables, rates and flushes, which the arbiter folds
+ * into what the hub runs.
+ *
+ * With a single client, its poll thread reads and decodes the hub
+ * inline. Once a second one attaches, a NanoHubReader takes over the
+ * hub and hands every decoded batch to all clients' queues; each client
+ * only copies out the events of sensors it enabled, and the flush
+ * completions and cached on-change state it asked for, which are tagged
+ * with client + 1 in reserved0 for that. Tagging happens at decode time
+ * whether or not the reader runs, so a batch decoded inline and left
+ * over when the reader takes over still reaches only its client.
+ */
 class NanoHub {
     struct sensor_config mSensorConfig[NANOHUB_ID_MAX];
+    struct sensor_rate_plan mRatePlan[NANOHUB_ID_MAX];
+    struct sensor_bias mBias[NANOHUB_ID_MAX];
+    sensors_event_t mLastEvent[NANOHUB_ID_MAX];
+    uint64_t mLastEventValid;
+    uint64_t mDirectPending[NANOHUB_MAX_CLIENTS];
     NanohubReadEventResponse mEvents;
+    struct TripleAxisDataPoint mExpanded[NANOHUB_COMPRESSED_SAMPLES_MAX];
+    bool mCompress;
+    NanoHubEventArena mArena;
+    struct nanohub_batch mBatch;    /* decoded, not handed out yet */
     int mDataFd;
+    uint32_t mReopenDelay;  /* ms, next reopen backoff */
+    int64_t mReopenDue;     /* boottime ns of the next reopen attempt */
+    bool mReopenOwed;       /* the hub failed and isn't reopened yet */
+    bool mResetPending;     /* the hub announced a reboot */
+    uint64_t mWifiSeen[NANOHUB_WIFI_DEDUP_SLOTS];
+    uint32_t mWifiSeenCount;
+    uint64_t mWifiWindowStart;
+
+    /*
+     * mConfigLock serializes everything that changes the configuration:
+     * mArbiter, mSensorConfig, mRatePlan rates and the hub writes. The
+     * poll thread never waits for it, it reads mConfig snapshots instead.
+     * Changes it needs, disarming a one-shot, replaying config after a
+     * hub reset or applying a new batch latency scale, are owed to
+     * whoever takes the lock next, binder thread or poll thread.
+     */
+    pthread_mutex_t mConfigLock;
+    NanoHubConfigTable mConfig;
+    uint32_t mConfigGen;
+    bool mClosing;
+
+    NanoHubArbiter mArbiter;
+    NanoHubDecimator mDecimator;
+    NanoHubFlushTracker mFlushes;
+    NanoHubSpinWait mSpin;
+    NanoHubFusion mFusion;
+    NanoHubGapDetector mGaps;
+    NanoHubBatchController mBatching;
+    bool mRebatchOwed;      /* batch latency scale changed */
+    bool mReplayOwed;       /* the hub lost its config */
+    uint64_t mDisarmOwed;   /* one-shots that fired */
+    NanoHubConfigTxn mTxn;
+    bool mAcked;            /* configs go through mTxn */
+    uint64_t mConfigStale;  /* handles the hub refused a config for */
+    bool mAcksOwed;         /* answers left for syncConfig() to collect */
+    NanoHubCalibration mCalibration;
+    uint64_t mCalRequested; /* hub calibration asked for since open */
+
+    /*
+     * mClientLock guards the client slots and starting the reader;
+     * mReadLock keeps inline reads and the reader thread off the decoder
+     * at the same time while it takes over. mBusy counts a client's poll
+     * threads between enter() and leave(), detach() waits for it to drop
+     * to 0 once mDetaching turned new entries away.
+     */
+    pthread_mutex_t mClientLock;
+    pthread_mutex_t mReadLock;
+    int mWakeFds[NANOHUB_MAX_CLIENTS];  /* -1: slot free */
+    uint32_t mBusy[NANOHUB_MAX_CLIENTS];
+    bool mDetaching[NANOHUB_MAX_CLIENTS];
+    uint32_t mClientMask[NANOHUB_ID_MAX];   /* clients each handle is enabled for */
+    NanoHubReader *mReader;
 
+    void initRatePlan(const struct sensor_t *sensor);
+    uint32_t wantedRate(int handle, int64_t period_ns);
+    uint32_t planRate(int handle, uint32_t wanted);
+    void updateDecimation(int handle);
+    void fillConfigHeader(int handle, struct sensor_config *config);
+    int sendConfig(int handle, const void *config, size_t len);
+    int writeConfig(int handle);
+    int writeBias(int handle, const float bias[3]);
+    void restoreCalibration(void);
+    int requestCalibration(int handle);
+    int completeConfig(void);
+    void collectConfig(void);
+    int updateHub(int handle, bool wait);
+    int streamOf(int handle) const;
+    void publishConfig(int handle);
+    bool isStreaming(int handle) const;
+    void syncConfig(void);
+    bool owesConfig(void) const;
+    void lockConfig(void);
+    void settleOwed(void);
+    void rebatch(void);
+    int reopen(void);
+    void retryReopen(void);
+    int recover(bool reopenFd);
+    void replayConfig(void);
+    bool wifiSeen(const uint8_t *bssid, uint64_t time);
+    int processFlushes(sensors_event_t* data, int sensor_id, int numFlushes);
+    bool acceptSample(const sensors_event_t* data);
+    void fillSample(sensors_event_t* data, int sensor_id, uint64_t time,
+                    float fvalue, uint32_t ivalue);
+    int processTriple(sensors_event_t* data, uint64_t referenceTime,
+                      const struct TripleAxisDataPoint *samples, int numSamples, int sensor_id);
+    int processCompressed(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id);
+    int processRotation(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id);
+    int processSingle(sensors_event_t* data, const struct EvtPacket *eventPacket, int sensor_id);
+    int processEmbedded(sensors_event_t* data, const struct NanohubReadEventResponse *event, int sensor_id);
+    int processWifiScan(sensors_event_t* data, const struct EvtPacket *eventPacket);
     int processEvent(sensors_event_t* data, const struct  NanohubReadEventResponse *event);
+    bool directPending(void) const;
+    int sendDirectEvents(sensors_event_t* data, int count);
+    int decodeBatch(struct nanohub_batch *batch);
+    int copyEvents(sensors_event_t* data, int count);
+    int startReader(void);
+    void kickReader(void);
+
 public:
-    NanoHub();
+    /* The HAL goes through acquire()/put(); a test can run on a fake fd */
+    NanoHub(const struct sensor_t *list, int count);
+    NanoHub(const struct sensor_t *list, int count, int dataFd,
+            const char *calPath = NANOHUB_CAL_PATH);
     virtual ~NanoHub();
+
+    static NanoHub *acquire(const struct sensor_t *list, int count);
+    static void put(NanoHub *hub);
+
+    int attach(int wakeFd);
+    void detach(int client);
+    bool enter(int client);
+    void leave(int client);
+    bool routes(int client, const sensors_event_t *ev) const;
+    NanoHubReader *getReader(void) const { return __atomic_load_n(&mReader, __ATOMIC_ACQUIRE); }
+
+    /* a client's poll thread, between enter() and leave() */
+    int getPollFd(int client) const;
+    bool hasPending(int client) const;
+    int readEvents(int client, sensors_event_t* data, int count);
+    int wait(int client, struct pollfd *fds, int nfds, int hubIdx, int timeoutMs);
+
+    /* the thread reading the hub */
     virtual int getFd(void);
-    int readEvents(sensors_event_t* data, int count);
+    int takeBatch(struct nanohub_batch *batch);
+    NanoHubEventArena *getArena(void) { return &mArena; }
+    int wait(struct pollfd *fds, int nfds, int hubIdx, int timeoutMs);
+    bool hasPending(void) const {
+        return mBatch.count > 0 || directPending() || mFlushes.hasLocal();
+    }
 
-    virtual int activate(int handle, int enabled);
-    virtual int batch(int handle, int64_t period_ns, int64_t timeout);
-    virtual int flush(int handle);
+    virtual int activate(int client, int handle, int enabled);
+    virtual int batch(int client, int handle, int64_t period_ns, int64_t timeout);
+    virtual int flush(int client, int handle);
 };
 
 #endif  // NANOHUB_H
@@ -105,6 +105,23 @@ struct NanohubAppInfoResponse {
     __le32 appSize;
 } __attribute__((packed));
 
+#define NANOHUB_REASON_QUERY_SENSOR_INFO      0x00001003
+
+struct NanohubSensorInfoRequest {
+    __le32 sensorIdx;
+} __attribute__((packed));
+
+#define NANOHUB_SENSOR_INFO_RATES_MAX 16
+
+struct NanohubSensorInfoResponse {
+    uint8_t sensorType;
+    uint8_t numAxis;
+    uint8_t interrupt;
+    uint8_t numRates;
+    __le16 minSamples;
+    __le32 supportedRates[NANOHUB_SENSOR_INFO_RATES_MAX]; /* only numRates are sent */
+} __attribute__((packed));
+
 #define NANOHUB_REASON_START_FIRMWARE_UPLOAD  0x00001040
 
 struct NanohubStartFirmwareUploadRequest {
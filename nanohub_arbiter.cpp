@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "nanohub_arbiter.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+/*
+ * Physical sensors each virtual sensor is fused from on the hub.
+ */
+static const struct {
+    int handle;
+    uint64_t sources;
+} sDependencies[] = {
+    { NANOHUB_ORIEN,  NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) |
+                      NANOHUB_HANDLE_BIT(NANOHUB_MAG) },
+    { NANOHUB_RV,     NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) |
+                      NANOHUB_HANDLE_BIT(NANOHUB_MAG) },
+    { NANOHUB_LA,     NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) },
+    { NANOHUB_GRAV,   NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) },
+    { NANOHUB_GAMERV, NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) },
+    { NANOHUB_GEORV,  NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_MAG) },
+};
+
+/*
+ * Handles decoded on the host from another handle's hub stream.
+ */
+static const struct {
+    int handle;
+    int source;
+} sAliases[] = {
+    { NANOHUB_GYRO_UNCAL, NANOHUB_GYRO },
+    { NANOHUB_MAG_UNCAL,  NANOHUB_MAG },
+    { NANOHUB_ORIEN,      NANOHUB_RV },
+};
+
+NanoHubArbiter::NanoHubArbiter()
+{
+    memset(mRequests, 0, sizeof(mRequests));
+    mHostFused = 0;
+}
+
+void NanoHubArbiter::request(uint32_t client, int handle)
+{
+    mRequests[handle][client].active = true;
+}
+
+void NanoHubArbiter::requestRateChange(uint32_t client, int handle, uint32_t rate, uint64_t latency)
+{
+    mRequests[handle][client].rate = rate;
+    mRequests[handle][client].latency = latency;
+}
+
+void NanoHubArbiter::release(uint32_t client, int handle)
+{
+    mRequests[handle][client].active = false;
+}
+
+/*
+ * affected: handles whose aggregate can change when handle's requests do.
+ */
+uint64_t NanoHubArbiter::affected(int handle) const
+{
+    uint64_t mask = NANOHUB_HANDLE_BIT(handle) | NANOHUB_HANDLE_BIT(getSource(handle));
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(sDependencies); i++) {
+        if (sDependencies[i].handle == handle) {
+            mask |= sDependencies[i].sources;
+        }
+    }
+
+    /* host fused sensors run at their sources' rate */
+    for (i = 0; i < ARRAY_SIZE(sDependencies); i++) {
+        if ((mHostFused & NANOHUB_HANDLE_BIT(sDependencies[i].handle)) &&
+            (sDependencies[i].sources & mask)) {
+            mask |= NANOHUB_HANDLE_BIT(sDependencies[i].handle);
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sAliases); i++) {
+        if (mask & NANOHUB_HANDLE_BIT(sAliases[i].source)) {
+            mask |= NANOHUB_HANDLE_BIT(sAliases[i].handle);
+        }
+    }
+
+    return mask;
+}
+
+/*
+ * collect: fold the active clients of one handle into rate/latency.
+ */
+bool NanoHubArbiter::collect(int handle, uint32_t *rate, uint64_t *latency) const
+{
+    bool active = false;
+
+    for (uint32_t i = 0; i < NANOHUB_MAX_CLIENTS; i++) {
+        const struct client_request *req = &mRequests[handle][i];
+        if (!req->active) {
+            continue;
+        }
+        active = true;
+        if (req->rate > *rate) {
+            *rate = req->rate;
+        }
+        if (req->latency < *latency) {
+            *latency = req->latency;
+        }
+    }
+
+    return active;
+}
+
+/*
+ * aggregate: what the hub should run handle at. Returns false when no
+ * client has it or one of its aliases enabled, and always for aliases
+ * and host fused sensors; virtual sensors only raise the rate of a
+ * physical sensor somebody already streams, unless they are fused on the
+ * host, then they need it streamed.
+ */
+bool NanoHubArbiter::aggregate(int handle, uint32_t *rate, uint64_t *latency) const
+{
+    bool active;
+    size_t i;
+
+    *rate = 0;
+    *latency = UINT64_MAX;
+
+    if (getSource(handle) != handle || isHostFused(handle)) {
+        *latency = 0;
+        return false;
+    }
+
+    active = collect(handle, rate, latency);
+    for (i = 0; i < ARRAY_SIZE(sAliases); i++) {
+        if (sAliases[i].source == handle && collect(sAliases[i].handle, rate, latency)) {
+            active = true;
+        }
+    }
+
+    for (i = 0; i < ARRAY_SIZE(sDependencies); i++) {
+        if ((sDependencies[i].sources & NANOHUB_HANDLE_BIT(handle)) &&
+            collect(sDependencies[i].handle, rate, latency) &&
+            isHostFused(sDependencies[i].handle)) {
+            active = true;
+        }
+    }
+
+    if (!active) {
+        *rate = 0;
+        *latency = 0;
+        return false;
+    }
+
+    return true;
+}
+
+bool NanoHubArbiter::isActive(uint32_t client, int handle) const
+{
+    return mRequests[handle][client].active;
+}
+
+uint32_t NanoHubArbiter::getRate(uint32_t client, int handle) const
+{
+    return mRequests[handle][client].rate;
+}
+
+/*
+ * getClients: bitmask of the clients that have handle enabled.
+ */
+uint32_t NanoHubArbiter::getClients(int handle) const
+{
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < NANOHUB_MAX_CLIENTS; i++) {
+        if (mRequests[handle][i].active) {
+            mask |= 1U << i;
+        }
+    }
+
+    return mask;
+}
+
+/*
+ * getMaxRate: the fastest rate an active client asked handle itself for.
+ */
+uint32_t NanoHubArbiter::getMaxRate(int handle) const
+{
+    uint32_t rate = 0;
+    uint64_t latency = UINT64_MAX;
+
+    collect(handle, &rate, &latency);
+
+    return rate;
+}
+
+void NanoHubArbiter::setHostFused(int handle)
+{
+    mHostFused |= NANOHUB_HANDLE_BIT(handle);
+}
+
+bool NanoHubArbiter::isHostFused(int handle) const
+{
+    return (mHostFused & NANOHUB_HANDLE_BIT(handle)) != 0;
+}
+
+/*
+ * getSource: the handle whose hub stream carries handle.
+ */
+int NanoHubArbiter::getSource(int handle)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sAliases); i++) {
+        if (sAliases[i].handle == handle) {
+            return sAliases[i].source;
+        }
+    }
+
+    return handle;
+}
+
+/*
+ * getAlias: the handle derived on the host from source, or -1.
+ */
+int NanoHubArbiter::getAlias(int source)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sAliases); i++) {
+        if (sAliases[i].source == source) {
+            return sAliases[i].handle;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_ARBITER_H
+#define NANOHUB_ARBITER_H
+
+#include <stdint.h>
+
+#include "nanohub_handles.h"
+
+#define NANOHUB_MAX_CLIENTS 4
+
+/*
+ * NanoHubArbiter: host side of sensorRequest()/sensorRequestRateChange().
+ *
+ * Every client keeps its own rate/latency per handle. What gets sent to
+ * the hub for a handle is the fastest rate and shortest latency of its
+ * active clients, and, for physical sensors, of the active virtual
+ * sensors fused from them. Rates are in samples per 1024s; 0 means the
+ * client has no preference.
+ *
+ * Some handles have no hub stream of their own but are derived on the
+ * host from another one (uncalibrated gyro/mag, orientation from the
+ * rotation vector); enabling them enables
+ * their source. Virtual sensors fused on the host instead of the hub have
+ * no hub stream either, and enable the physical sensors they need.
+ */
+class NanoHubArbiter {
+    struct client_request {
+        uint32_t rate;
+        uint64_t latency;
+        bool active;
+    } mRequests[NANOHUB_ID_MAX][NANOHUB_MAX_CLIENTS];
+    uint64_t mHostFused;
+
+    bool collect(int handle, uint32_t *rate, uint64_t *latency) const;
+
+public:
+    NanoHubArbiter();
+
+    void request(uint32_t client, int handle);
+    void requestRateChange(uint32_t client, int handle, uint32_t rate, uint64_t latency);
+    void release(uint32_t client, int handle);
+
+    uint64_t affected(int handle) const;
+    bool aggregate(int handle, uint32_t *rate, uint64_t *latency) const;
+    bool isActive(uint32_t client, int handle) const;
+    uint32_t getRate(uint32_t client, int handle) const;
+    uint32_t getClients(int handle) const;
+    uint32_t getMaxRate(int handle) const;
+
+    void setHostFused(int handle);
+    bool isHostFused(int handle) const;
+
+    static int getSource(int handle);
+    static int getAlias(int source);
+};
+
+#endif  // NANOHUB_ARBITER_H
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "nanohub_arena.h"
+
+static_assert(NANOHUB_ARENA_BLOCKS <= 32, "arena free set is a 32-bit mask");
+
+NanoHubEventArena::NanoHubEventArena()
+{
+    for (int i = 0; i < NANOHUB_ARENA_BLOCKS; i++) {
+        mBlocks[i].refs = 0;
+    }
+    mFree = (NANOHUB_ARENA_BLOCKS == 32) ? UINT32_MAX : (1U << NANOHUB_ARENA_BLOCKS) - 1;
+    mInUse = 0;
+    mBlocksHighWater = 0;
+    mEventsHighWater = 0;
+    mExhausted = 0;
+}
+
+/*
+ * alloc: take a free block for an empty batch, holding one reference.
+ * Returns -ENOMEM when every block is held.
+ */
+int NanoHubEventArena::alloc(struct nanohub_batch *batch)
+{
+    uint32_t free = __atomic_load_n(&mFree, __ATOMIC_ACQUIRE);
+    uint32_t inUse;
+    int block;
+
+    do {
+        if (!free) {
+            __atomic_fetch_add(&mExhausted, 1, __ATOMIC_RELAXED);
+            batch->block = -1;
+            return -ENOMEM;
+        }
+        block = __builtin_ctz(free);
+    } while (!__atomic_compare_exchange_n(&mFree, &free, free & ~(1U << block), true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    mBlocks[block].refs = 1;
+    batch->block = block;
+    batch->start = 0;
+    batch->count = 0;
+
+    inUse = __atomic_add_fetch(&mInUse, 1, __ATOMIC_RELAXED);
+    if (inUse > __atomic_load_n(&mBlocksHighWater, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&mBlocksHighWater, inUse, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+void NanoHubEventArena::acquire(const struct nanohub_batch *batch)
+{
+    __atomic_fetch_add(&mBlocks[batch->block].refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * release: drop batch's reference, the block goes back to the free set
+ * with the last one.
+ */
+void NanoHubEventArena::release(struct nanohub_batch *batch)
+{
+    int block = batch->block;
+
+    if (block < 0) {
+        return;
+    }
+    batch->block = -1;
+    batch->count = 0;
+
+    if (__atomic_sub_fetch(&mBlocks[block].refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_fetch_sub(&mInUse, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&mFree, 1U << block, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * commit: the events written to a fresh batch's block.
+ */
+void NanoHubEventArena::commit(struct nanohub_batch *batch, int count)
+{
+    batch->count = count;
+    if ((uint32_t)count > mEventsHighWater) {
+        mEventsHighWater = count;
+    }
+}
+
+/*
+ * copyOut: the one copy, from batch into the caller's buffer. Returns how
+ * many events were copied and moves the batch past them.
+ */
+int NanoHubEventArena::copyOut(struct nanohub_batch *batch, sensors_event_t *data, int count)
+{
+    int n = batch->count < count ? batch->count : count;
+
+    if (n <= 0) {
+        return 0;
+    }
+    memcpy(data, events(batch), n * sizeof(sensors_event_t));
+    batch->start += n;
+    batch->count -= n;
+
+    return n;
+}
+
+void NanoHubEventArena::dump(void) const
+{
+    ALOGI("arena: %u/%d blocks high water, %u/%d events per block high water, %u exhausted",
+          mBlocksHighWater, NANOHUB_ARENA_BLOCKS, mEventsHighWater, NANOHUB_ARENA_BLOCK_EVENTS,
+          mExhausted);
+}
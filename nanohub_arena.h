@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_ARENA_H
+#define NANOHUB_ARENA_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#define NANOHUB_ARENA_BLOCKS        8       /* at most 32 */
+#define NANOHUB_ARENA_BLOCK_EVENTS  512     /* one decoded packet, worst case */
+
+/*
+ * A run of decoded events in an arena block. Whoever holds a batch holds
+ * a reference to its block; stages hand batches on instead of copying the
+ * events, and each holder keeps its own start/count.
+ */
+struct nanohub_batch
+{
+    int16_t block;      /* -1: none */
+    uint16_t start;
+    uint16_t count;
+};
+
+/*
+ * NanoHubEventArena: preallocated, fixed size blocks of sensors_event_t.
+ *
+ * A packet is decoded straight into a block and filtered in place there;
+ * the block is only copied out once, into the framework's buffer. Blocks
+ * are reference counted and can be released from any thread, the free
+ * set is a bitmask updated with atomics. The arena tracks how many blocks
+ * and events per block were ever in use, to size it from real loads.
+ */
+class NanoHubEventArena {
+    struct block {
+        sensors_event_t events[NANOHUB_ARENA_BLOCK_EVENTS];
+        uint32_t refs;
+    } mBlocks[NANOHUB_ARENA_BLOCKS];
+    uint32_t mFree;
+
+    uint32_t mInUse;
+    uint32_t mBlocksHighWater;
+    uint32_t mEventsHighWater;
+    uint32_t mExhausted;
+
+public:
+    NanoHubEventArena();
+
+    int alloc(struct nanohub_batch *batch);
+    void acquire(const struct nanohub_batch *batch);
+    void release(struct nanohub_batch *batch);
+    void commit(struct nanohub_batch *batch, int count);
+
+    sensors_event_t *events(const struct nanohub_batch *batch) {
+        return &mBlocks[batch->block].events[batch->start];
+    }
+    int copyOut(struct nanohub_batch *batch, sensors_event_t *data, int count);
+
+    void dump(void) const;
+};
+
+#endif  // NANOHUB_ARENA_H
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <cutils/log.h>
+
+#include "nanohub_batching.h"
+
+NanoHubBatchController::NanoHubBatchController()
+{
+    mEnabled = false;
+    mFifoSize = 0;
+    mScale = NANOHUB_BATCHING_ONE;
+    mPeriodStart = 0;
+    mLastWake = 0;
+    mBurst = 0;
+    mMaxBurst = 0;
+    mWakes = 0;
+    mSamples = 0;
+    mLastGaps = 0;
+}
+
+/*
+ * setFifoSize: the hub FIFO is shared, the largest fifoMaxEventCount of
+ * any sensor is its size.
+ */
+void NanoHubBatchController::setFifoSize(uint32_t events)
+{
+    if (events > mFifoSize) {
+        mFifoSize = events;
+    }
+}
+
+/*
+ * limit: the latency to send the hub for a client bound of latency.
+ * Called with the HAL config lock held, on any thread.
+ */
+uint64_t NanoHubBatchController::limit(uint64_t latency) const
+{
+    uint32_t scale = __atomic_load_n(&mScale, __ATOMIC_RELAXED);
+
+    if (!mEnabled || scale >= NANOHUB_BATCHING_ONE) {
+        return latency;
+    }
+
+    return latency / NANOHUB_BATCHING_ONE * scale;
+}
+
+/*
+ * decoded: samples the hub sent in one packet, on the poll thread. These
+ * are what its FIFO held, not the events they decode to.
+ */
+void NanoHubBatchController::decoded(int samples)
+{
+    if (samples > 0) {
+        mBurst += samples;
+        mSamples += samples;
+    }
+}
+
+/*
+ * wake: the poll thread was woken by the hub after blocking for waited
+ * ns. Returns true when the latency scale changed and the batched streams
+ * need to be reconfigured.
+ */
+bool NanoHubBatchController::wake(int64_t now, int64_t waited, uint32_t gaps)
+{
+    uint32_t scale = mScale;
+
+    if (!mEnabled || !mFifoSize) {
+        return false;
+    }
+
+    /* the kernel still had data queued, this is the same burst */
+    if (waited < NANOHUB_BATCHING_BURST_GAP_NS && mLastWake) {
+        return false;
+    }
+    if (mBurst > mMaxBurst) {
+        mMaxBurst = mBurst;
+    }
+    mBurst = 0;
+    mLastWake = now;
+    mWakes++;
+
+    if (!mPeriodStart) {
+        mPeriodStart = now;
+        mLastGaps = gaps;
+        return false;
+    }
+    if (now - mPeriodStart < NANOHUB_BATCHING_PERIOD_NS) {
+        return false;
+    }
+
+    if (gaps != mLastGaps || mMaxBurst > mFifoSize - mFifoSize / 8) {
+        scale /= 2;
+        if (scale < NANOHUB_BATCHING_MIN_SCALE) {
+            scale = NANOHUB_BATCHING_MIN_SCALE;
+        }
+    } else if (mMaxBurst < mFifoSize / 2 && scale < NANOHUB_BATCHING_ONE) {
+        scale += NANOHUB_BATCHING_STEP;
+        if (scale > NANOHUB_BATCHING_ONE) {
+            scale = NANOHUB_BATCHING_ONE;
+        }
+    }
+
+    ALOGV("batching: %u wakes %u samples, burst max %u/%u, %u gaps, scale %u/%d",
+          mWakes, mSamples, mMaxBurst, mFifoSize, gaps - mLastGaps, scale, NANOHUB_BATCHING_ONE);
+
+    mPeriodStart = now;
+    mMaxBurst = 0;
+    mWakes = 0;
+    mSamples = 0;
+    mLastGaps = gaps;
+
+    if (scale == mScale) {
+        return false;
+    }
+    ALOGD("batching: hub latency scale %u/%d", scale, NANOHUB_BATCHING_ONE);
+    __atomic_store_n(&mScale, scale, __ATOMIC_RELAXED);
+
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_BATCHING_H
+#define NANOHUB_BATCHING_H
+
+#include <stdint.h>
+
+#define NANOHUB_BATCHING_ONE            1024            /* scale of 1.0 */
+#define NANOHUB_BATCHING_MIN_SCALE      (NANOHUB_BATCHING_ONE / 64)
+#define NANOHUB_BATCHING_STEP           (NANOHUB_BATCHING_ONE / 8)
+#define NANOHUB_BATCHING_PERIOD_NS      1000000000LL    /* decide at most this often */
+#define NANOHUB_BATCHING_BURST_GAP_NS   1000000LL       /* shorter waits continue a burst */
+
+/*
+ * NanoHubBatchController: pick the hub batch latency within the client's
+ * bound from how the hub FIFO actually fills.
+ *
+ * Every batched stream is sent the client's max_report_latency scaled by
+ * one factor, since all of them share the hub FIFO. The poll thread
+ * reports how many samples arrived per wakeup burst and how many gaps
+ * the gap detector saw. Once a period the factor is halved if a burst
+ * came within 1/8 of fifoMaxEventCount or samples were lost. Otherwise
+ * it grows back one step towards 1.0 while bursts stay under half the
+ * FIFO. At 1.0 the client's latency is sent as is, which gives the
+ * largest batches and fewest packets the client allows.
+ */
+class NanoHubBatchController {
+    bool mEnabled;
+    uint32_t mFifoSize;     /* shared hub FIFO, events */
+    uint32_t mScale;        /* NANOHUB_BATCHING_ONE based */
+
+    int64_t mPeriodStart;
+    int64_t mLastWake;
+    uint32_t mBurst;        /* samples since the burst started */
+    uint32_t mMaxBurst;     /* this period */
+    uint32_t mWakes;
+    uint32_t mSamples;
+    uint32_t mLastGaps;
+
+public:
+    NanoHubBatchController();
+
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+    void setFifoSize(uint32_t events);
+    uint64_t limit(uint64_t latency) const;
+
+    void decoded(int samples);
+    bool wake(int64_t now, int64_t waited, uint32_t gaps);
+};
+
+#endif  // NANOHUB_BATCHING_H
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "nanohub_cal.h"
+
+struct NanoHubCalHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+} __attribute__((packed));
+
+struct NanoHubCalEntry {
+    uint8_t sensorType;     /* hub sensor type, stable across HAL handles */
+    uint8_t pad[3];
+    float bias[3];
+} __attribute__((packed));
+
+NanoHubCalibration::NanoHubCalibration()
+{
+    memset(mCal, 0, sizeof(mCal));
+    mPath = NANOHUB_CAL_PATH;
+    mDirty = false;
+    mSaveDue = false;
+    mStop = false;
+    mLastSave = 0;
+    pthread_mutex_init(&mLock, NULL);
+    pthread_mutex_init(&mStoreLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+    mWriterStarted = pthread_create(&mWriter, NULL, writerThread, this) == 0;
+    if (!mWriterStarted) {
+        ALOGE("calibration: no writer thread, biases are stored on close only");
+    }
+}
+
+NanoHubCalibration::~NanoHubCalibration()
+{
+    if (mWriterStarted) {
+        pthread_mutex_lock(&mLock);
+        mStop = true;
+        pthread_cond_signal(&mCond);
+        pthread_mutex_unlock(&mLock);
+        pthread_join(mWriter, NULL);
+    }
+    save();
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mStoreLock);
+    pthread_mutex_destroy(&mLock);
+}
+
+void *NanoHubCalibration::writerThread(void *arg)
+{
+    ((NanoHubCalibration *)arg)->run();
+
+    return NULL;
+}
+
+/*
+ * run: the writer thread, storing the biases whenever update() finds
+ * a write due.
+ */
+void NanoHubCalibration::run(void)
+{
+    pthread_mutex_lock(&mLock);
+    for (;;) {
+        while (!mSaveDue && !mStop) {
+            pthread_cond_wait(&mCond, &mLock);
+        }
+        if (mStop) {
+            break;
+        }
+        mSaveDue = false;
+        pthread_mutex_unlock(&mLock);
+        save();
+        pthread_mutex_lock(&mLock);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * load: read back what the last run stored at path, where new biases go
+ * from then on. Entries for sensors this HAL doesn't calibrate are
+ * skipped.
+ */
+void NanoHubCalibration::load(const char *path)
+{
+    struct NanoHubCalHeader hdr;
+    struct NanoHubCalEntry entry;
+    int fd, n = 0;
+
+    pthread_mutex_lock(&mStoreLock);
+    mPath = path;
+    pthread_mutex_unlock(&mStoreLock);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == NANOHUB_CAL_MAGIC &&
+        hdr.version == NANOHUB_CAL_VERSION) {
+        for (uint32_t i = 0; i < hdr.count; i++) {
+            if (read(fd, &entry, sizeof(entry)) != sizeof(entry)) {
+                break;
+            }
+            for (int h = 0; h < NANOHUB_ID_MAX; h++) {
+                if ((NANOHUB_CALIBRATABLE & NANOHUB_HANDLE_BIT(h)) &&
+                    handle_to_nanohub_type(h) == entry.sensorType) {
+                    memcpy(mCal[h].bias, entry.bias, sizeof(entry.bias));
+                    mCal[h].valid = true;
+                    n++;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+
+    close(fd);
+
+    ALOGI("calibration: %d biases loaded", n);
+}
+
+bool NanoHubCalibration::get(int handle, float bias[3]) const
+{
+    bool valid;
+
+    pthread_mutex_lock(&mLock);
+    valid = mCal[handle].valid;
+    if (valid) {
+        memcpy(bias, mCal[handle].bias, sizeof(mCal[handle].bias));
+    }
+    pthread_mutex_unlock(&mLock);
+
+    return valid;
+}
+
+/*
+ * update: the hub reported a new bias for handle. The writer stores it
+ * once enough time passed since the last write.
+ */
+void NanoHubCalibration::update(int handle, const float bias[3], int64_t now)
+{
+    struct cal_entry *cal = &mCal[handle];
+    bool changed;
+
+    if (!(NANOHUB_CALIBRATABLE & NANOHUB_HANDLE_BIT(handle))) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+    changed = !cal->valid;
+    for (int i = 0; i < 3; i++) {
+        if (fabsf(cal->bias[i] - bias[i]) > NANOHUB_CAL_EPSILON) {
+            changed = true;
+        }
+    }
+    if (changed) {
+        memcpy(cal->bias, bias, sizeof(cal->bias));
+        cal->valid = true;
+        mDirty = true;
+    }
+    if (mDirty && now - mLastSave >= NANOHUB_CAL_SAVE_NS) {
+        mSaveDue = true;
+        mLastSave = now;
+        pthread_cond_signal(&mCond);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+/*
+ * save: store a copy of the biases if they changed since the last write,
+ * from the calling thread: the writer's, or the one closing the HAL. A
+ * failed write leaves them dirty for the next one.
+ */
+void NanoHubCalibration::save(void)
+{
+    struct cal_entry cal[NANOHUB_ID_MAX];
+    bool dirty;
+
+    pthread_mutex_lock(&mStoreLock);
+
+    pthread_mutex_lock(&mLock);
+    dirty = mDirty;
+    memcpy(cal, mCal, sizeof(cal));
+    mDirty = false;
+    pthread_mutex_unlock(&mLock);
+
+    if (dirty && !store(cal)) {
+        pthread_mutex_lock(&mLock);
+        mDirty = true;
+        pthread_mutex_unlock(&mLock);
+    }
+
+    pthread_mutex_unlock(&mStoreLock);
+}
+
+/*
+ * store: write every valid bias in cal out, replacing the file
+ * atomically: the new one is synced before it is renamed over the old,
+ * so a crash leaves one or the other. Called with mStoreLock held.
+ */
+bool NanoHubCalibration::store(const struct cal_entry *cal)
+{
+    char tmpPath[PATH_MAX + 4];
+    struct NanoHubCalEntry entries[NANOHUB_ID_MAX];
+    struct NanoHubCalHeader hdr;
+    ssize_t size;
+    int fd;
+
+    memset(entries, 0, sizeof(entries));
+    hdr.magic = NANOHUB_CAL_MAGIC;
+    hdr.version = NANOHUB_CAL_VERSION;
+    hdr.count = 0;
+    for (int h = 0; h < NANOHUB_ID_MAX; h++) {
+        if (cal[h].valid) {
+            entries[hdr.count].sensorType = handle_to_nanohub_type(h);
+            memcpy(entries[hdr.count].bias, cal[h].bias, sizeof(cal[h].bias));
+            hdr.count++;
+        }
+    }
+    size = hdr.count * sizeof(entries[0]);
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", mPath);
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (fd < 0) {
+        ALOGW("can't write '%s': %s", tmpPath, strerror(errno));
+        return false;
+    }
+
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, entries, size) != size ||
+        fsync(fd) < 0) {
+        ALOGW("can't write '%s': %s", tmpPath, strerror(errno));
+        close(fd);
+        unlink(tmpPath);
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmpPath, mPath) < 0) {
+        ALOGW("can't replace '%s': %s", mPath, strerror(errno));
+        unlink(tmpPath);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_CAL_H
+#define NANOHUB_CAL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "nanohub_handles.h"
+
+#define NANOHUB_CAL_PATH        "/data/misc/sensors/nanohub_cal.bin"
+#define NANOHUB_CAL_MAGIC       0x4243484e  /* "NHCB" */
+#define NANOHUB_CAL_VERSION     1
+#define NANOHUB_CAL_SAVE_NS     60000000000LL   /* write new biases at most this often */
+#define NANOHUB_CAL_EPSILON     1e-4f           /* smaller changes aren't worth a write */
+
+/* Streams whose bias the hub estimates and can be handed back */
+#define NANOHUB_CALIBRATABLE (NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | \
+                              NANOHUB_HANDLE_BIT(NANOHUB_GYRO) | \
+                              NANOHUB_HANDLE_BIT(NANOHUB_MAG))
+
+/*
+ * Streams the hub may calibrate on its own when nothing is stored. Gyro
+ * calibration only needs the device at rest, which the hub detects;
+ * accel and mag calibration need it held in set poses, so those wait
+ * for the hub's runtime estimate or a stored bias.
+ */
+#define NANOHUB_AUTO_CALIBRATE  NANOHUB_HANDLE_BIT(NANOHUB_GYRO)
+
+/*
+ * NanoHubCalibration: sensor biases kept across hub and AP reboots.
+ *
+ * The hub reports a new bias in a slot of a sample batch whenever its
+ * calibration moves. The last one of every calibratable stream is kept
+ * here and written to the file load() read, NANOHUB_CAL_PATH on a device,
+ * one entry per sensor keyed by its hub sensor type, at most once per
+ * NANOHUB_CAL_SAVE_NS and on close. NanoHub hands the stored biases back
+ * to the hub when it opens it, so sensors start out calibrated instead
+ * of converging from scratch.
+ *
+ * update() runs on the poll thread and only takes note; the file is
+ * written by a thread of this class's own, so /data I/O never holds up
+ * decoding. mLock guards the biases, mStoreLock the file.
+ */
+class NanoHubCalibration {
+    struct cal_entry {
+        float bias[3];
+        bool valid;
+    } mCal[NANOHUB_ID_MAX];
+    const char *mPath;
+    bool mDirty;
+    bool mSaveDue;          /* update() woke the writer */
+    bool mStop;
+    int64_t mLastSave;
+    mutable pthread_mutex_t mLock;
+    pthread_mutex_t mStoreLock;
+    pthread_cond_t mCond;
+    pthread_t mWriter;
+    bool mWriterStarted;
+
+    static void *writerThread(void *arg);
+    void run(void);
+    bool store(const struct cal_entry *cal);
+
+public:
+    NanoHubCalibration();
+    ~NanoHubCalibration();
+
+    void load(const char *path);
+    bool get(int handle, float bias[3]) const;
+    void update(int handle, const float bias[3], int64_t now);
+    void save(void);
+};
+
+#endif  // NANOHUB_CAL_H
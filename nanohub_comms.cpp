@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "nanohub_comms.h"
+
+NanoHubComms::NanoHubComms()
+    : mSeq(0)
+{
+    mFd = open(NANOHUB_COMMS_PATH, O_RDWR | O_NONBLOCK);
+    if (mFd < 0) {
+        ALOGW("open file '%s' failed: %s\n", NANOHUB_COMMS_PATH, strerror(errno));
+    }
+}
+
+NanoHubComms::~NanoHubComms()
+{
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+/*
+ * send: queue one request, return its sequence number in *seq.
+ */
+int NanoHubComms::send(uint32_t reason, const void *data, uint8_t len, uint32_t *seq)
+{
+    struct NanohubPacket *packet = (struct NanohubPacket *)mTxBuf;
+    int err;
+
+    if (mFd < 0) {
+        return -ENODEV;
+    }
+
+    packet->sync = NANOHUB_SYNC_BYTE;
+    packet->seq = ++mSeq;
+    packet->reason = reason;
+    packet->len = len;
+    if (len) {
+        memcpy(packet->data, data, len);
+    }
+
+    err = write(mFd, mTxBuf, sizeof(struct NanohubPacket) + len);
+    if (err < 0) {
+        ALOGE("comms write reason 0x%08x failed: %s", reason, strerror(errno));
+        return -errno;
+    }
+
+    if (seq) {
+        *seq = packet->seq;
+    }
+
+    return 0;
+}
+
+/*
+ * recv: wait up to timeoutMs for the next reply, whatever its sequence.
+ *
+ * *len is the capacity of data on entry and the payload length on return.
+ */
+int NanoHubComms::recv(uint32_t *seq, uint32_t *reason, void *data, uint8_t *len, int timeoutMs)
+{
+    struct NanohubPacket *packet = (struct NanohubPacket *)mRxBuf;
+    struct pollfd pfd;
+    int n;
+
+    if (mFd < 0) {
+        return -ENODEV;
+    }
+
+    pfd.fd = mFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    do {
+        n = poll(&pfd, 1, timeoutMs);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return -errno;
+    } else if (n == 0) {
+        return -ETIMEDOUT;
+    }
+
+    n = read(mFd, mRxBuf, sizeof(mRxBuf));
+    if (n < 0) {
+        return -errno;
+    } else if (n < (int)sizeof(struct NanohubPacket) ||
+               n < (int)sizeof(struct NanohubPacket) + packet->len) {
+        ALOGE("short comms packet: %d bytes", n);
+        return -EIO;
+    }
+
+    *seq = packet->seq;
+    *reason = packet->reason;
+    if (packet->len < *len) {
+        *len = packet->len;
+    }
+    memcpy(data, packet->data, *len);
+
+    return 0;
+}
+
+/*
+ * transact: one synchronous request/reply round trip.
+ */
+int NanoHubComms::transact(uint32_t reason, const void *req, uint8_t reqLen,
+                           void *rsp, uint8_t *rspLen)
+{
+    uint32_t seq, rxSeq, rxReason;
+    uint8_t cap = *rspLen;
+    int err;
+
+    err = send(reason, req, reqLen, &seq);
+    if (err < 0) {
+        return err;
+    }
+
+    do {
+        *rspLen = cap;
+        err = recv(&rxSeq, &rxReason, rsp, rspLen, NANOHUB_COMMS_TIMEOUT_MS);
+        if (err < 0) {
+            return err;
+        }
+    } while (rxSeq != seq);
+
+    if (rxReason != reason) {
+        return -EIO;
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_COMMS_H
+#define NANOHUB_COMMS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "nanohubPacket.h"
+
+#define NANOHUB_COMMS_PATH          "/dev/nanohub_comms"
+#define NANOHUB_COMMS_TIMEOUT_MS    100
+
+/*
+ * NanoHubComms: request/response channel to the hub OS.
+ *
+ * /dev/nanohub only carries sensor events. Informational requests
+ * (NANOHUB_REASON_*) go through the comms node as bare NanohubPacket
+ * headers followed by the payload; the driver adds preamble and CRC.
+ * Every request gets a fresh sequence number and the hub echoes it in
+ * the reply, so several requests may be outstanding at once.
+ */
+class NanoHubComms {
+    int mFd;
+    uint32_t mSeq;
+    uint8_t mTxBuf[sizeof(struct NanohubPacket) + NANOHUB_PACKET_PAYLOAD_MAX];
+    uint8_t mRxBuf[sizeof(struct NanohubPacket) + NANOHUB_PACKET_PAYLOAD_MAX];
+
+public:
+    NanoHubComms();
+    ~NanoHubComms();
+
+    bool isOpen(void) const { return mFd >= 0; }
+    int getFd(void) const { return mFd; }
+
+    int send(uint32_t reason, const void *data, uint8_t len, uint32_t *seq);
+    int recv(uint32_t *seq, uint32_t *reason, void *data, uint8_t *len, int timeoutMs);
+    int transact(uint32_t reason, const void *req, uint8_t reqLen,
+                 void *rsp, uint8_t *rspLen);
+};
+
+#endif  // NANOHUB_COMMS_H
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "nanohub_config.h"
+
+static_assert(sizeof(struct sensor_snapshot) % sizeof(uint32_t) == 0,
+              "sensor_snapshot must be made of whole words");
+
+NanoHubConfigTable::NanoHubConfigTable()
+{
+    memset(mSlots, 0, sizeof(mSlots));
+    mGeneration = 0;
+}
+
+/*
+ * publish: odd sequence while the words are rewritten, so readers that
+ * overlap the update know to retry. Only one publisher at a time.
+ */
+void NanoHubConfigTable::publish(int handle, const struct sensor_snapshot *snap)
+{
+    struct slot *s = &mSlots[handle];
+    uint32_t words[SNAPSHOT_WORDS];
+    uint32_t seq = s->seq;
+
+    memcpy(words, snap, sizeof(words));
+
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int i = 0; i < SNAPSHOT_WORDS; i++) {
+        __atomic_store_n(&s->words[i], words[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&mGeneration, 1, __ATOMIC_RELEASE);
+}
+
+void NanoHubConfigTable::read(int handle, struct sensor_snapshot *snap) const
+{
+    const struct slot *s = &mSlots[handle];
+    uint32_t words[SNAPSHOT_WORDS];
+    uint32_t seq0, seq1;
+
+    do {
+        seq0 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < SNAPSHOT_WORDS; i++) {
+            words[i] = __atomic_load_n(&s->words[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    } while ((seq0 & 1) || seq0 != seq1);
+
+    memcpy(snap, words, sizeof(words));
+}
+
+uint32_t NanoHubConfigTable::generation(void) const
+{
+    return __atomic_load_n(&mGeneration, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_CONFIG_H
+#define NANOHUB_CONFIG_H
+
+#include <stdint.h>
+
+#include "nanohub_handles.h"
+
+/*
+ * What the poll thread needs to know about a handle's configuration.
+ */
+struct sensor_snapshot
+{
+    uint64_t latency;       /* hub side, ns */
+    uint32_t hubRate;       /* samples per 1024s */
+    uint32_t requestedRate;
+    uint32_t decimation;
+    uint32_t active;        /* this client has it enabled */
+    uint32_t hubEnabled;    /* its hub stream runs, for any client */
+};
+
+/*
+ * NanoHubConfigTable: per handle configuration snapshots behind a
+ * seqlock.
+ *
+ * Configuration changes are published by one writer at a time (callers
+ * serialize on the HAL config lock); the poll thread reads them without
+ * taking any lock, retrying in the rare case it raced a publish. The
+ * generation count moves on every publish, so a reader can tell cheaply
+ * whether anything changed since it last looked.
+ */
+class NanoHubConfigTable {
+    enum {
+        SNAPSHOT_WORDS = sizeof(struct sensor_snapshot) / sizeof(uint32_t),
+    };
+
+    struct slot {
+        uint32_t seq;
+        uint32_t words[SNAPSHOT_WORDS];
+    } mSlots[NANOHUB_ID_MAX];
+    uint32_t mGeneration;
+
+public:
+    NanoHubConfigTable();
+
+    void publish(int handle, const struct sensor_snapshot *snap);
+    void read(int handle, struct sensor_snapshot *snap) const;
+    uint32_t generation(void) const;
+};
+
+#endif  // NANOHUB_CONFIG_H
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "nanohub_decimator.h"
+
+/* Sensors whose samples are plain vectors and can be averaged */
+#define NANOHUB_AVERAGEABLE (NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_GYRO) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_MAG) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_LA) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_GRAV))
+
+NanoHubDecimator::NanoHubDecimator()
+{
+    memset(mState, 0, sizeof(mState));
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        mState[i].factor = 1;
+    }
+}
+
+void NanoHubDecimator::setFactor(int handle, uint32_t factor)
+{
+    struct decimator_state *st = &mState[handle];
+
+    if (factor < 1) {
+        factor = 1;
+    }
+    if (st->factor != factor) {
+        st->factor = factor;
+        st->count = 0;
+    }
+}
+
+void NanoHubDecimator::setMode(int handle, enum nanohub_decimation_mode mode)
+{
+    if (mode == NANOHUB_DECIMATE_BOXCAR && !(NANOHUB_AVERAGEABLE & NANOHUB_HANDLE_BIT(handle))) {
+        mode = NANOHUB_DECIMATE_DROP;
+    }
+    mState[handle].mode = mode;
+    mState[handle].count = 0;
+}
+
+/*
+ * emit: write out the average of the current window and restart it.
+ */
+void NanoHubDecimator::emit(int handle, sensors_event_t *ev)
+{
+    struct decimator_state *st = &mState[handle];
+    float scale = 1.0f / st->count;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->version = sizeof(sensors_event_t);
+    ev->sensor = handle;
+    ev->type = st->type;
+    ev->timestamp = st->firstTimestamp + (st->lastTimestamp - st->firstTimestamp) / 2;
+    ev->acceleration.x = st->sum[0] * scale;
+    ev->acceleration.y = st->sum[1] * scale;
+    ev->acceleration.z = st->sum[2] * scale;
+    ev->acceleration.status = st->status;
+
+    st->count = 0;
+}
+
+/*
+ * process: decimate data[0..count) in place, return the events left.
+ * data has room for max events.
+ *
+ * The write index never passes the read index, so nothing is copied for
+ * streams that are not decimated. A flush completion closes any partial
+ * window of its sensor first, so everything sampled before the flush is
+ * still delivered ahead of it; when nothing was dropped before the flush
+ * to make room for the average, the rest of the buffer moves up one.
+ */
+int NanoHubDecimator::process(sensors_event_t *data, int count, int max)
+{
+    struct decimator_state *st;
+    sensors_event_t *ev;
+    int handle, out = 0;
+
+    for (int i = 0; i < count; i++) {
+        ev = &data[i];
+
+        if (ev->type == SENSOR_TYPE_META_DATA) {
+            handle = ev->meta_data.sensor;
+            if (handle >= 0 && handle < NANOHUB_ID_MAX && mState[handle].count) {
+                st = &mState[handle];
+                if (st->mode == NANOHUB_DECIMATE_BOXCAR && out == i && count < max) {
+                    memmove(&data[i + 1], &data[i], (count - i) * sizeof(*data));
+                    count++;
+                    ev = &data[++i];
+                }
+                if (st->mode == NANOHUB_DECIMATE_BOXCAR && out < i) {
+                    emit(handle, &data[out++]);
+                }
+                st->count = 0;
+            }
+        } else if (ev->sensor >= 0 && ev->sensor < NANOHUB_ID_MAX &&
+                   mState[ev->sensor].factor > 1) {
+            st = &mState[ev->sensor];
+
+            if (st->mode == NANOHUB_DECIMATE_BOXCAR) {
+                if (st->count == 0) {
+                    st->firstTimestamp = ev->timestamp;
+                    st->type = ev->type;
+                    st->sum[0] = st->sum[1] = st->sum[2] = 0.0f;
+                }
+                st->lastTimestamp = ev->timestamp;
+                st->status = ev->acceleration.status;
+                st->sum[0] += ev->acceleration.x;
+                st->sum[1] += ev->acceleration.y;
+                st->sum[2] += ev->acceleration.z;
+                if (++st->count >= st->factor) {
+                    emit(ev->sensor, &data[out++]);
+                }
+                continue;
+            }
+
+            if (++st->count < st->factor) {
+                continue;
+            }
+            st->count = 0;
+        }
+
+        if (out != i) {
+            data[out] = *ev;
+        }
+        out++;
+    }
+
+    return out;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_DECIMATOR_H
+#define NANOHUB_DECIMATOR_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub_handles.h"
+
+enum nanohub_decimation_mode {
+    NANOHUB_DECIMATE_DROP,      /* keep every Nth sample */
+    NANOHUB_DECIMATE_BOXCAR,    /* average each run of N samples */
+};
+
+/*
+ * NanoHubDecimator: bring a sensor stream down from the hub rate to the
+ * client rate, in place on a decoded event buffer.
+ *
+ * Boxcar averaging is a first order CIC: it suppresses what would alias
+ * into the output band, and the averaged sample is stamped at the middle
+ * of its window. It only makes sense for plain vector sensors, everything
+ * else is always decimated by dropping.
+ */
+class NanoHubDecimator {
+    struct decimator_state {
+        uint32_t factor;
+        uint32_t count;
+        uint8_t mode;
+        int8_t status;
+        int32_t type;
+        int64_t firstTimestamp;
+        int64_t lastTimestamp;
+        float sum[3];
+    } mState[NANOHUB_ID_MAX];
+
+    void emit(int handle, sensors_event_t *ev);
+
+public:
+    NanoHubDecimator();
+
+    void setFactor(int handle, uint32_t factor);
+    void setMode(int handle, enum nanohub_decimation_mode mode);
+    int process(sensors_event_t *data, int count, int max);
+};
+
+#endif  // NANOHUB_DECIMATOR_H
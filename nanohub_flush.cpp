@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "nanohub_flush.h"
+
+NanoHubFlushTracker::NanoHubFlushTracker()
+{
+    memset(mQueue, 0, sizeof(mQueue));
+    memset(mLocal, 0, sizeof(mLocal));
+    mLocalMask = 0;
+}
+
+/*
+ * push: a flush of handle was sent down source's stream. Returns -EAGAIN
+ * when too many are outstanding on it already.
+ */
+int NanoHubFlushTracker::push(int source, int handle, int client)
+{
+    struct flush_queue *q = &mQueue[source];
+    uint32_t tail = q->tail;
+
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= NANOHUB_FLUSH_QUEUE_MAX) {
+        return -EAGAIN;
+    }
+
+    q->handle[tail & (NANOHUB_FLUSH_QUEUE_MAX - 1)] = handle;
+    q->client[tail & (NANOHUB_FLUSH_QUEUE_MAX - 1)] = client;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * cancel: take back the last push on source, the hub never got it.
+ */
+void NanoHubFlushTracker::cancel(int source)
+{
+    struct flush_queue *q = &mQueue[source];
+
+    __atomic_store_n(&q->tail, q->tail - 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * pop: the handle and client the next completion on source's stream is
+ * for. A completion nobody asked for is reported on the source itself,
+ * to no client in particular (-1).
+ */
+int NanoHubFlushTracker::pop(int source, int *client)
+{
+    struct flush_queue *q = &mQueue[source];
+    uint32_t head = q->head;
+    int handle;
+
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+        *client = -1;
+        return source;
+    }
+
+    handle = q->handle[head & (NANOHUB_FLUSH_QUEUE_MAX - 1)];
+    *client = q->client[head & (NANOHUB_FLUSH_QUEUE_MAX - 1)];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    return handle;
+}
+
+uint32_t NanoHubFlushTracker::pending(int source) const
+{
+    return __atomic_load_n(&mQueue[source].tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&mQueue[source].head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * abandon: the hub lost every outstanding flush, complete them locally.
+ * Called by the consumer.
+ */
+void NanoHubFlushTracker::abandon(void)
+{
+    int handle, client;
+
+    for (int source = 0; source < NANOHUB_ID_MAX; source++) {
+        while (pending(source)) {
+            handle = pop(source, &client);
+            pushLocal(handle, client);
+        }
+    }
+}
+
+void NanoHubFlushTracker::pushLocal(int handle, int client)
+{
+    __atomic_fetch_add(&mLocal[handle][client], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&mLocalMask, NANOHUB_HANDLE_BIT(handle), __ATOMIC_RELEASE);
+}
+
+bool NanoHubFlushTracker::hasLocal(void) const
+{
+    return __atomic_load_n(&mLocalMask, __ATOMIC_ACQUIRE) != 0;
+}
+
+/*
+ * popLocal: write out up to count local completions, return how many.
+ * Each carries its client + 1 in reserved0 for fan-out.
+ */
+int NanoHubFlushTracker::popLocal(sensors_event_t *data, int count)
+{
+    uint64_t mask = __atomic_exchange_n(&mLocalMask, 0, __ATOMIC_ACQ_REL);
+    uint64_t left = 0;
+    uint32_t n;
+    int handle, num_events = 0;
+
+    while (mask) {
+        handle = __builtin_ctzll(mask);
+        mask &= mask - 1;
+
+        for (int client = 0; client < NANOHUB_MAX_CLIENTS; client++) {
+            n = __atomic_exchange_n(&mLocal[handle][client], 0, __ATOMIC_ACQ_REL);
+            for (; n && num_events < count; n--) {
+                memset(&data[num_events], 0, sizeof(sensors_event_t));
+                data[num_events].version = META_DATA_VERSION;
+                data[num_events].type = SENSOR_TYPE_META_DATA;
+                data[num_events].reserved0 = client + 1;
+                data[num_events].meta_data.what = META_DATA_FLUSH_COMPLETE;
+                data[num_events].meta_data.sensor = handle;
+                num_events++;
+            }
+            if (n) {
+                __atomic_fetch_add(&mLocal[handle][client], n, __ATOMIC_RELAXED);
+                left |= NANOHUB_HANDLE_BIT(handle);
+            }
+        }
+    }
+
+    if (left) {
+        __atomic_fetch_or(&mLocalMask, left, __ATOMIC_RELEASE);
+    }
+
+    return num_events;
+}
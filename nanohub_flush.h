@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_FLUSH_H
+#define NANOHUB_FLUSH_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub_arbiter.h"
+#include "nanohub_handles.h"
+
+#define NANOHUB_FLUSH_QUEUE_MAX 16  /* power of 2 */
+
+/*
+ * NanoHubFlushTracker: which handle each flush completion answers.
+ *
+ * The hub completes flushes per stream, in the order they were asked
+ * for, right after the samples it had batched; an alias flushes through
+ * its source stream. Every stream keeps a FIFO of the handles flushed on
+ * it, so the completion is attributed to the right one and never jumps
+ * ahead of an earlier flush.
+ *
+ * Every flush also remembers the client that asked for it, so that with
+ * several clients sharing the hub only that one sees the completion.
+ *
+ * Flushes of a stream the hub doesn't batch are completed locally,
+ * without a hub round trip, once everything already decoded has been
+ * handed out.
+ *
+ * When the hub resets, the flushes it had outstanding are lost with it;
+ * they are completed locally instead.
+ *
+ * flush() and the poll thread may run concurrently: each FIFO has a
+ * single producer and a single consumer, and the local counts are
+ * atomics.
+ */
+class NanoHubFlushTracker {
+    struct flush_queue {
+        uint8_t handle[NANOHUB_FLUSH_QUEUE_MAX];
+        uint8_t client[NANOHUB_FLUSH_QUEUE_MAX];
+        uint32_t head;
+        uint32_t tail;
+    } mQueue[NANOHUB_ID_MAX];
+    uint32_t mLocal[NANOHUB_ID_MAX][NANOHUB_MAX_CLIENTS];
+    uint64_t mLocalMask;
+
+public:
+    NanoHubFlushTracker();
+
+    int push(int source, int handle, int client);
+    void cancel(int source);
+    int pop(int source, int *client);
+    uint32_t pending(int source) const;
+    void abandon(void);
+
+    void pushLocal(int handle, int client);
+    bool hasLocal(void) const;
+    int popLocal(sensors_event_t *data, int count);
+};
+
+#endif  // NANOHUB_FLUSH_H
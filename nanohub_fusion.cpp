@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+
+#include "nanohub_fusion.h"
+#include "nanohub_info.h"
+#include "nanohub_quat.h"
+
+#define FUSION_KP           0.5f    /* proportional gain, 1/s */
+#define FUSION_KI           0.005f  /* integral gain, 1/s^2 */
+#define FUSION_DT_MAX       0.1f    /* s, longer gaps restart integration */
+
+/* Outputs of the gravity-only filter */
+#define FUSION_GAME_HANDLES (NANOHUB_HANDLE_BIT(NANOHUB_GAMERV) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_GRAV) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_LA))
+/* Outputs of the gravity and north filter */
+#define FUSION_FULL_HANDLES (NANOHUB_HANDLE_BIT(NANOHUB_RV) | \
+                             NANOHUB_HANDLE_BIT(NANOHUB_ORIEN))
+
+static inline void cross(const float a[3], const float b[3], float out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline bool normalize3(const float v[3], float out[3])
+{
+    float n = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    float s;
+
+    if (!(n > 0.0f)) {
+        return false;
+    }
+    s = inv_sqrt(n);
+    for (int i = 0; i < 3; i++) {
+        out[i] = v[i] * s;
+    }
+
+    return true;
+}
+
+/*
+ * hub_provides: the hub runs handle itself.
+ */
+static bool hub_provides(int handle)
+{
+    NanoHubInfo *info = NanoHubInfo::getInstance();
+
+    if (info->hasSensorInfo()) {
+        return info->findSensor(handle_to_nanohub_type(handle)) != NULL;
+    }
+
+    return info->providesSensor(handle);
+}
+
+NanoHubFusion::NanoHubFusion()
+{
+    memset(&mGame, 0, sizeof(mGame));
+    memset(&mFull, 0, sizeof(mFull));
+    memset(mAccel, 0, sizeof(mAccel));
+    memset(mMag, 0, sizeof(mMag));
+    mHaveAccel = false;
+    mHaveMag = false;
+    mLastGyro = 0;
+    mActive = 0;
+}
+
+/*
+ * setActive: host fused handles enabled right now. Filters whose outputs
+ * all went away start over from the next sample.
+ */
+void NanoHubFusion::setActive(uint64_t mask)
+{
+    if (!(mask & FUSION_GAME_HANDLES)) {
+        mGame.valid = false;
+    }
+    if (!(mask & FUSION_FULL_HANDLES)) {
+        mFull.valid = false;
+    }
+    if (!mask) {
+        mHaveAccel = mHaveMag = false;
+        mLastGyro = 0;
+    }
+    mActive = mask;
+}
+
+/*
+ * wants: handle's samples feed an active output.
+ */
+bool NanoHubFusion::wants(int handle) const
+{
+    switch (handle) {
+        case NANOHUB_ACCEL:
+            return mActive != 0;
+        case NANOHUB_GYRO:
+            return (mActive & (FUSION_GAME_HANDLES | FUSION_FULL_HANDLES)) != 0;
+        case NANOHUB_MAG:
+            return (mActive & (FUSION_FULL_HANDLES | NANOHUB_HANDLE_BIT(NANOHUB_GEORV))) != 0;
+        default:
+            return false;
+    }
+}
+
+/*
+ * update: one Mahony step. The error between where the attitude puts
+ * gravity (and north) and where accel (and mag) see it is fed back into
+ * the gyro rate, then the rate is integrated into the quaternion.
+ */
+void NanoHubFusion::update(struct attitude *att, const float gyro[3], const float *mag, float dt)
+{
+    float R[9], a[3], m[3], v[3], h[3], b[3], w[3], e[3], t[3], g[3];
+    float *q = att->q;
+    float dq[4];
+    int i;
+
+    if (!normalize3(mAccel, a)) {
+        return;
+    }
+
+    if (!att->valid) {
+        /* start level, or from the direct solution when north is known */
+        if (mag && normalize3(mag, m)) {
+            cross(m, a, h);
+            if (normalize3(h, R)) {
+                cross(a, R, &R[3]);
+                memcpy(&R[6], a, sizeof(a));
+                matrix_to_quat(R, q);
+            } else {
+                return;
+            }
+        } else {
+            q[0] = q[1] = q[2] = 0.0f;
+            q[3] = 1.0f;
+        }
+        memset(att->bias, 0, sizeof(att->bias));
+        att->valid = true;
+        return;
+    }
+
+    quat_to_matrix(q, R);
+
+    /* gravity in the device frame: last row of R */
+    v[0] = R[6];
+    v[1] = R[7];
+    v[2] = R[8];
+    cross(a, v, e);
+
+    if (mag && normalize3(mag, m)) {
+        /* field in the world frame, flattened onto north and up */
+        for (i = 0; i < 3; i++) {
+            h[i] = R[3 * i] * m[0] + R[3 * i + 1] * m[1] + R[3 * i + 2] * m[2];
+        }
+        b[0] = 0.0f;
+        b[1] = sqrtf(h[0] * h[0] + h[1] * h[1]);
+        b[2] = h[2];
+        /* back into the device frame */
+        for (i = 0; i < 3; i++) {
+            w[i] = R[i] * b[0] + R[3 + i] * b[1] + R[6 + i] * b[2];
+        }
+        cross(m, w, t);
+        for (i = 0; i < 3; i++) {
+            e[i] += t[i];
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        att->bias[i] += FUSION_KI * e[i] * dt;
+        g[i] = (gyro[i] + FUSION_KP * e[i] + att->bias[i]) * 0.5f * dt;
+    }
+
+    dq[0] =  q[3] * g[0] + q[1] * g[2] - q[2] * g[1];
+    dq[1] =  q[3] * g[1] - q[0] * g[2] + q[2] * g[0];
+    dq[2] =  q[3] * g[2] + q[0] * g[1] - q[1] * g[0];
+    dq[3] = -q[0] * g[0] - q[1] * g[1] - q[2] * g[2];
+    for (i = 0; i < 4; i++) {
+        q[i] += dq[i];
+    }
+    quat_normalize(q);
+}
+
+/*
+ * fill: the event handle reports for attitude q.
+ */
+void NanoHubFusion::fill(sensors_event_t *ev, int handle, int64_t time, const float q[4])
+{
+    float R[9];
+
+    memset(ev, 0, sizeof(*ev));
+    ev->version = sizeof(sensors_event_t);
+    ev->sensor = handle;
+    ev->timestamp = time;
+
+    switch (handle) {
+        case NANOHUB_RV:
+        case NANOHUB_GEORV:
+            ev->type = handle == NANOHUB_RV ? SENSOR_TYPE_ROTATION_VECTOR :
+                                              SENSOR_TYPE_GEOMAGNETIC_ROTATION_VECTOR;
+            memcpy(ev->data, q, 4 * sizeof(float));
+            ev->data[4] = -1.0f;    /* heading accuracy unknown */
+            break;
+        case NANOHUB_GAMERV:
+            ev->type = SENSOR_TYPE_GAME_ROTATION_VECTOR;
+            memcpy(ev->data, q, 4 * sizeof(float));
+            break;
+        case NANOHUB_ORIEN:
+            ev->type = SENSOR_TYPE_ORIENTATION;
+            quat_to_matrix(q, R);
+            matrix_to_orientation(R, ev->data);
+            ev->orientation.status = SENSOR_STATUS_ACCURACY_MEDIUM;
+            break;
+        case NANOHUB_GRAV:
+        case NANOHUB_LA:
+            ev->type = handle == NANOHUB_GRAV ? SENSOR_TYPE_GRAVITY :
+                                                SENSOR_TYPE_LINEAR_ACCELERATION;
+            quat_to_matrix(q, R);
+            for (int i = 0; i < 3; i++) {
+                ev->data[i] = GRAVITY_EARTH * R[6 + i];
+                if (handle == NANOHUB_LA) {
+                    ev->data[i] = mAccel[i] - ev->data[i];
+                }
+            }
+            ev->acceleration.status = SENSOR_STATUS_ACCURACY_HIGH;
+            break;
+    }
+}
+
+/*
+ * process: feed one calibrated sample of handle, write the fused events
+ * it produces to out (at most NANOHUB_FUSION_EVENTS_MAX) and return how
+ * many.
+ */
+int NanoHubFusion::process(int handle, int64_t time, const float v[3], sensors_event_t *out)
+{
+    float R[9], a[3], e[3], q[4];
+    float dt;
+    int n = 0;
+
+    switch (handle) {
+        case NANOHUB_ACCEL:
+            memcpy(mAccel, v, sizeof(mAccel));
+            mHaveAccel = true;
+            return 0;
+
+        case NANOHUB_MAG:
+            memcpy(mMag, v, sizeof(mMag));
+            mHaveMag = true;
+            if (!(mActive & NANOHUB_HANDLE_BIT(NANOHUB_GEORV)) || !mHaveAccel) {
+                return 0;
+            }
+            /* east = mag x up, north = up x east; their rows make R */
+            if (!normalize3(mAccel, a)) {
+                return 0;
+            }
+            cross(v, a, e);
+            if (!normalize3(e, R)) {
+                return 0;
+            }
+            cross(a, R, &R[3]);
+            memcpy(&R[6], a, sizeof(a));
+            matrix_to_quat(R, q);
+            fill(&out[n++], NANOHUB_GEORV, time, q);
+            return n;
+
+        case NANOHUB_GYRO:
+            break;
+
+        default:
+            return 0;
+    }
+
+    dt = mLastGyro ? (time - mLastGyro) * 1e-9f : 0.0f;
+    mLastGyro = time;
+    if (!mHaveAccel || dt <= 0.0f || dt > FUSION_DT_MAX) {
+        return 0;
+    }
+
+    if (mActive & FUSION_GAME_HANDLES) {
+        bool wasValid = mGame.valid;
+
+        update(&mGame, v, NULL, dt);
+        if (wasValid) {
+            if (mActive & NANOHUB_HANDLE_BIT(NANOHUB_GAMERV)) {
+                fill(&out[n++], NANOHUB_GAMERV, time, mGame.q);
+            }
+            if (mActive & NANOHUB_HANDLE_BIT(NANOHUB_GRAV)) {
+                fill(&out[n++], NANOHUB_GRAV, time, mGame.q);
+            }
+            if (mActive & NANOHUB_HANDLE_BIT(NANOHUB_LA)) {
+                fill(&out[n++], NANOHUB_LA, time, mGame.q);
+            }
+        }
+    }
+
+    if ((mActive & FUSION_FULL_HANDLES) && mHaveMag) {
+        bool wasValid = mFull.valid;
+
+        update(&mFull, v, mMag, dt);
+        if (wasValid) {
+            if (mActive & NANOHUB_HANDLE_BIT(NANOHUB_RV)) {
+                fill(&out[n++], NANOHUB_RV, time, mFull.q);
+            }
+            if (mActive & NANOHUB_HANDLE_BIT(NANOHUB_ORIEN)) {
+                fill(&out[n++], NANOHUB_ORIEN, time, mFull.q);
+            }
+        }
+    }
+
+    return n;
+}
+
+/*
+ * getDriver: the physical stream whose samples clock handle's output.
+ */
+int NanoHubFusion::getDriver(int handle)
+{
+    return handle == NANOHUB_GEORV ? NANOHUB_MAG : NANOHUB_GYRO;
+}
+
+/*
+ * useHostFusion: whether handle is fused here rather than on the hub.
+ * persist.nanohub.host_fusion is 1 (always), 0 (never) or auto: when the
+ * hub answered but doesn't run handle while it does run its inputs.
+ */
+bool NanoHubFusion::useHostFusion(int handle)
+{
+    char mode[PROPERTY_VALUE_MAX];
+
+    if (handle < 0 || handle >= NANOHUB_ID_MAX ||
+        !(NANOHUB_FUSION_HANDLES & NANOHUB_HANDLE_BIT(handle))) {
+        return false;
+    }
+
+    property_get("persist.nanohub.host_fusion", mode, "auto");
+    if (!strcmp(mode, "1")) {
+        return true;
+    } else if (strcmp(mode, "auto") || !NanoHubInfo::getInstance()->isValid()) {
+        return false;
+    }
+
+    if (hub_provides(handle) || !hub_provides(NANOHUB_ACCEL)) {
+        return false;
+    }
+    if (handle == NANOHUB_GEORV) {
+        return hub_provides(NANOHUB_MAG);
+    }
+    if (!hub_provides(NANOHUB_GYRO)) {
+        return false;
+    }
+
+    return (NANOHUB_HANDLE_BIT(handle) & FUSION_FULL_HANDLES) ? hub_provides(NANOHUB_MAG) : true;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_FUSION_H
+#define NANOHUB_FUSION_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub_handles.h"
+
+/* Handles the host can fuse itself */
+#define NANOHUB_FUSION_HANDLES (NANOHUB_HANDLE_BIT(NANOHUB_ORIEN) | \
+                                NANOHUB_HANDLE_BIT(NANOHUB_RV) | \
+                                NANOHUB_HANDLE_BIT(NANOHUB_LA) | \
+                                NANOHUB_HANDLE_BIT(NANOHUB_GRAV) | \
+                                NANOHUB_HANDLE_BIT(NANOHUB_GAMERV) | \
+                                NANOHUB_HANDLE_BIT(NANOHUB_GEORV))
+
+/* Most events one input sample can produce */
+#define NANOHUB_FUSION_EVENTS_MAX 5
+
+/*
+ * NanoHubFusion: host side fallback for the hub's fusion app.
+ *
+ * When the hub has no fusion, or persist.nanohub.host_fusion asks for it,
+ * the virtual sensors are computed here from the calibrated accel, gyro
+ * and mag samples as they are decoded. Attitude is tracked by two
+ * quaternion complementary filters (Mahony): one corrected by gravity
+ * alone for the game rotation vector, gravity and linear acceleration,
+ * one also corrected by the magnetic field for the rotation vector and
+ * orientation. The geomagnetic rotation vector takes no gyro and is
+ * solved directly from gravity and north.
+ *
+ * Outputs follow the gyro (mag for the geomagnetic rotation vector), with
+ * a fixed amount of work per input sample and no allocation;
+ * tests/nanohub_fusion_benchmark measures what that costs.
+ */
+class NanoHubFusion {
+    struct attitude {
+        float q[4];         /* x, y, z, w */
+        float bias[3];      /* integral term, rad/s */
+        bool valid;
+    };
+
+    struct attitude mGame;
+    struct attitude mFull;
+    float mAccel[3];
+    float mMag[3];
+    bool mHaveAccel;
+    bool mHaveMag;
+    int64_t mLastGyro;
+    uint64_t mActive;
+
+    void update(struct attitude *att, const float gyro[3], const float *mag, float dt);
+    void fill(sensors_event_t *ev, int handle, int64_t time, const float q[4]);
+
+public:
+    NanoHubFusion();
+
+    void setActive(uint64_t mask);
+    bool wants(int handle) const;
+    int process(int handle, int64_t time, const float v[3], sensors_event_t *out);
+
+    static int getDriver(int handle);
+    static bool useHostFusion(int handle);
+};
+
+#endif  // NANOHUB_FUSION_H
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "nanohub_gaps.h"
+
+NanoHubGapDetector::NanoHubGapDetector()
+{
+    memset(mState, 0, sizeof(mState));
+    mVerbose = false;
+    mTotalSpans = 0;
+}
+
+NanoHubGapDetector::~NanoHubGapDetector()
+{
+    for (int i = 0; i < NANOHUB_ID_MAX; i++) {
+        dump(i);
+    }
+}
+
+void NanoHubGapDetector::dump(int handle) const
+{
+    const struct gap_state *st = &mState[handle];
+
+    if (st->spans) {
+        ALOGI("sensor %d: %" PRIu64 " samples lost in %u gaps", handle, st->lost, st->spans);
+    }
+}
+
+/*
+ * setPeriod: the sample period handle's hub stream is configured for, 0
+ * to stop tracking it. Counters are logged and restarted when tracking
+ * stops.
+ */
+void NanoHubGapDetector::setPeriod(int handle, int64_t period_ns)
+{
+    struct gap_state *st = &mState[handle];
+
+    if (st->period == period_ns) {
+        return;
+    }
+
+    if (!period_ns) {
+        dump(handle);
+        memset(st, 0, sizeof(*st));
+        return;
+    }
+
+    st->prevPeriod = st->lastTimestamp ? st->period : 0;
+    st->period = period_ns;
+}
+
+/*
+ * check: account for one sample of a tracked stream.
+ */
+void NanoHubGapDetector::check(int handle, int64_t timestamp)
+{
+    struct gap_state *st = &mState[handle];
+    int64_t period = st->period;
+    int64_t delta = timestamp - st->lastTimestamp;
+    uint64_t lost;
+
+    if (!st->lastTimestamp || delta <= 0) {
+        st->lastTimestamp = timestamp;
+        return;
+    }
+
+    if (st->prevPeriod) {
+        if (delta <= period + period / 2) {
+            st->prevPeriod = 0;
+        } else if (st->prevPeriod > period) {
+            period = st->prevPeriod;
+        }
+    }
+
+    if (delta > period + period / 2) {
+        lost = (delta + period / 2) / period - 1;
+        st->spans++;
+        mTotalSpans++;
+        st->lost += lost;
+        if (mVerbose) {
+            ALOGI("sensor %d: %" PRIu64 " samples lost between %" PRId64 " and %" PRId64,
+                  handle, lost, st->lastTimestamp, timestamp);
+        } else {
+            ALOGV("sensor %d: %" PRIu64 " samples lost, %" PRId64 " ns gap", handle, lost, delta);
+        }
+    }
+
+    st->lastTimestamp = timestamp;
+}
+
+/*
+ * process: look for gaps in decoded, not yet decimated, events.
+ */
+void NanoHubGapDetector::process(const sensors_event_t *data, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const sensors_event_t *ev = &data[i];
+
+        if (ev->type != SENSOR_TYPE_META_DATA && ev->sensor >= 0 &&
+            ev->sensor < NANOHUB_ID_MAX && mState[ev->sensor].period) {
+            check(ev->sensor, ev->timestamp);
+        }
+    }
+}
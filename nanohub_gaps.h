@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_GAPS_H
+#define NANOHUB_GAPS_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub_handles.h"
+
+/*
+ * NanoHubGapDetector: spot samples lost on the hub, typically a batch
+ * FIFO that overflowed before the host drained it.
+ *
+ * The host only sees that as a hole in a sensor's timestamps, so every
+ * tracked stream's inter-sample delta is checked against the period of
+ * the rate the hub was configured for. A delta over one and a half
+ * periods is a gap; its lost samples are counted per sensor and logged,
+ * each gap too when verbose. Gaps stay out of the event stream, as the
+ * framework takes any meta event from the HAL for a flush completion.
+ * Across a rate change the slower of the two periods is used until the
+ * stream has settled on the new one.
+ */
+class NanoHubGapDetector {
+    struct gap_state {
+        int64_t period;         /* ns, 0: not tracked */
+        int64_t prevPeriod;     /* until settled after a change */
+        int64_t lastTimestamp;
+        uint32_t spans;
+        uint64_t lost;
+    } mState[NANOHUB_ID_MAX];
+
+    bool mVerbose;
+    uint32_t mTotalSpans;
+
+    void check(int handle, int64_t timestamp);
+    void dump(int handle) const;
+
+public:
+    NanoHubGapDetector();
+    ~NanoHubGapDetector();
+
+    void setVerbose(bool verbose) { mVerbose = verbose; }
+    void setPeriod(int handle, int64_t period_ns);
+    void process(const sensors_event_t *data, int count);
+    uint32_t spans(void) const { return mTotalSpans; }
+};
+
+#endif  // NANOHUB_GAPS_H
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_HANDLES_H
+#define NANOHUB_HANDLES_H
+
+/*
+ * HAL sensor handles. A handle is also the index into every per-sensor
+ * table in the HAL.
+ */
+enum nanohub_sensor_id {
+    NANOHUB_ACCEL,
+    NANOHUB_GYRO,
+    NANOHUB_MAG,
+    NANOHUB_ORIEN,
+    NANOHUB_RV,
+    NANOHUB_LA,
+    NANOHUB_GRAV,
+    NANOHUB_GAMERV,
+    NANOHUB_GEORV,
+    NANOHUB_SD,
+    NANOHUB_SC,
+    NANOHUB_WIFI,
+    NANOHUB_GYRO_UNCAL,
+    NANOHUB_MAG_UNCAL,
+    NANOHUB_ANY_MOTION,
+    NANOHUB_NO_MOTION,
+    NANOHUB_SIG_MOTION,
+    NANOHUB_FLAT,
+    NANOHUB_BARO,
+    NANOHUB_TEMP,
+    NANOHUB_ALS,
+    NANOHUB_PROX,
+    NANOHUB_HR_ECG,
+    NANOHUB_HR_PPG,
+    NANOHUB_GESTURE,
+    NANOHUB_TILT,
+    NANOHUB_DOUBLE_TWIST,
+    NANOHUB_DOUBLE_TAP,
+    NANOHUB_WIN_ORIEN,
+    NANOHUB_HALL,
+    NANOHUB_ACTIVITY,
+    NANOHUB_VSYNC,
+    NANOHUB_ID_MAX,
+};
+
+#define NANOHUB_HANDLE_BIT(handle) (1ULL << (handle))
+
+int handle_to_nanohub_type(int handle);
+
+#endif  // NANOHUB_HANDLES_H
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "nanohub.h"
+#include "nanohub_info.h"
+#include "nanohub_sensors.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+struct NanoHubInfoCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    struct NanohubOsHwVersionsResponse versions;
+    uint32_t numApps;
+    uint32_t numSensors;
+} __attribute__((packed));
+
+/*
+ * Which HAL sensors each firmware app provides. App ids are the ones
+ * assigned by the firmware build; keep in sync with it.
+ */
+static const struct {
+    uint64_t appId;
+    uint64_t handles;
+} sAppSensorMap[] = {
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 2),     /* bmi160 */
+      NANOHUB_HANDLE_BIT(NANOHUB_ACCEL) | NANOHUB_HANDLE_BIT(NANOHUB_GYRO) |
+      NANOHUB_HANDLE_BIT(NANOHUB_GYRO_UNCAL) | NANOHUB_HANDLE_BIT(NANOHUB_SD) |
+      NANOHUB_HANDLE_BIT(NANOHUB_SC) | NANOHUB_HANDLE_BIT(NANOHUB_ANY_MOTION) |
+      NANOHUB_HANDLE_BIT(NANOHUB_NO_MOTION) | NANOHUB_HANDLE_BIT(NANOHUB_FLAT) |
+      NANOHUB_HANDLE_BIT(NANOHUB_DOUBLE_TAP) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 3),     /* magnetometer */
+      NANOHUB_HANDLE_BIT(NANOHUB_MAG) | NANOHUB_HANDLE_BIT(NANOHUB_MAG_UNCAL) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 4),     /* fusion */
+      NANOHUB_HANDLE_BIT(NANOHUB_ORIEN) | NANOHUB_HANDLE_BIT(NANOHUB_RV) |
+      NANOHUB_HANDLE_BIT(NANOHUB_LA) | NANOHUB_HANDLE_BIT(NANOHUB_GRAV) |
+      NANOHUB_HANDLE_BIT(NANOHUB_GAMERV) | NANOHUB_HANDLE_BIT(NANOHUB_GEORV) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 5),     /* bmp280 */
+      NANOHUB_HANDLE_BIT(NANOHUB_BARO) | NANOHUB_HANDLE_BIT(NANOHUB_TEMP) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 6),     /* hall */
+      NANOHUB_HANDLE_BIT(NANOHUB_HALL) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 7),     /* als/prox */
+      NANOHUB_HANDLE_BIT(NANOHUB_ALS) | NANOHUB_HANDLE_BIT(NANOHUB_PROX) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 8),     /* gestures */
+      NANOHUB_HANDLE_BIT(NANOHUB_GESTURE) | NANOHUB_HANDLE_BIT(NANOHUB_DOUBLE_TWIST) |
+      NANOHUB_HANDLE_BIT(NANOHUB_WIN_ORIEN) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 9),     /* significant motion, tilt */
+      NANOHUB_HANDLE_BIT(NANOHUB_SIG_MOTION) | NANOHUB_HANDLE_BIT(NANOHUB_TILT) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 10),    /* activity */
+      NANOHUB_HANDLE_BIT(NANOHUB_ACTIVITY) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 11),    /* vsync */
+      NANOHUB_HANDLE_BIT(NANOHUB_VSYNC) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 12),    /* wifi */
+      NANOHUB_HANDLE_BIT(NANOHUB_WIFI) },
+    { NANOHUB_APP_ID(NANOHUB_APP_VENDOR_GOOGLE, 13),    /* heart rate */
+      NANOHUB_HANDLE_BIT(NANOHUB_HR_ECG) | NANOHUB_HANDLE_BIT(NANOHUB_HR_PPG) },
+};
+
+static pthread_once_t sInfoOnce = PTHREAD_ONCE_INIT;
+static NanoHubInfo *sInfo = NULL;
+
+NanoHubInfo::NanoHubInfo()
+    : mNumApps(0),
+      mNumSensors(0),
+      mValid(false)
+{
+    memset(&mVersions, 0, sizeof(mVersions));
+    memset(mApps, 0, sizeof(mApps));
+    memset(mSensors, 0, sizeof(mSensors));
+}
+
+void NanoHubInfo::init(void)
+{
+    sInfo = new NanoHubInfo();
+    sInfo->load();
+}
+
+NanoHubInfo *NanoHubInfo::getInstance(void)
+{
+    pthread_once(&sInfoOnce, init);
+    return sInfo;
+}
+
+/*
+ * load: fill in versions and apps, from the cache when it still matches.
+ */
+void NanoHubInfo::load(void)
+{
+    NanoHubComms comms;
+    int err;
+
+    if (!comms.isOpen()) {
+        return;
+    }
+
+    err = queryVersions(comms);
+    if (err < 0) {
+        ALOGE("hub version query failed: %d", err);
+        return;
+    }
+
+    ALOGI("hub hw %04x/%04x bl %04x os %04x variant %08x",
+          mVersions.hwType, mVersions.hwVer, mVersions.blVer,
+          mVersions.osVer, mVersions.variantVer);
+
+    if (loadCache()) {
+        mValid = true;
+        return;
+    }
+
+    err = enumerate(comms, NANOHUB_REASON_QUERY_APP_INFO, mApps, sizeof(mApps[0]),
+                    sizeof(mApps[0]), NANOHUB_INFO_MAX_APPS, &mNumApps);
+    if (err < 0) {
+        ALOGE("hub app enumeration failed: %d", err);
+        return;
+    }
+
+    /* Older firmware doesn't know QUERY_SENSOR_INFO; the app map still works */
+    err = enumerate(comms, NANOHUB_REASON_QUERY_SENSOR_INFO, mSensors, sizeof(mSensors[0]),
+                    offsetof(struct NanohubSensorInfoResponse, supportedRates),
+                    NANOHUB_INFO_MAX_SENSORS, &mNumSensors);
+    if (err < 0) {
+        ALOGW("hub sensor enumeration failed: %d", err);
+        mNumSensors = 0;
+    }
+
+    mValid = true;
+    storeCache();
+}
+
+int NanoHubInfo::queryVersions(NanoHubComms &comms)
+{
+    uint8_t len = sizeof(mVersions);
+    int err;
+
+    err = comms.transact(NANOHUB_REASON_GET_OS_HW_VERSIONS, NULL, 0, &mVersions, &len);
+    if (err < 0) {
+        return err;
+    } else if (len != sizeof(mVersions)) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * enumerate: walk an indexed hub table (apps, sensors).
+ *
+ * Both requests carry a single __le32 index. Up to NANOHUB_INFO_QUERY_DEPTH
+ * requests are kept in flight. The hub answers an empty payload past the
+ * last entry; once we see one we stop issuing and drain what is
+ * outstanding.
+ */
+int NanoHubInfo::enumerate(NanoHubComms &comms, uint32_t reason, void *table,
+                           size_t entrySize, size_t minLen, uint32_t max, uint32_t *count)
+{
+    uint8_t rsp[NANOHUB_PACKET_PAYLOAD_MAX];
+    uint32_t firstSeq = 0, seq, rxReason, idx, req;
+    uint32_t next = 0, inFlight = 0, end = max;
+    uint8_t len;
+    int err;
+
+    while (next < end || inFlight) {
+        while (next < end && inFlight < NANOHUB_INFO_QUERY_DEPTH) {
+            req = next;
+            err = comms.send(reason, &req, sizeof(req), &seq);
+            if (err < 0) {
+                return err;
+            }
+            if (next == 0) {
+                firstSeq = seq;
+            }
+            next++;
+            inFlight++;
+        }
+
+        len = sizeof(rsp);
+        err = comms.recv(&seq, &rxReason, rsp, &len, NANOHUB_COMMS_TIMEOUT_MS);
+        if (err < 0) {
+            return err;
+        }
+
+        idx = seq - firstSeq;
+        if (idx >= next) {
+            continue;
+        }
+        inFlight--;
+
+        if (rxReason != reason) {
+            return -EIO;
+        } else if (len < minLen) {
+            if (idx < end) {
+                end = idx;
+            }
+        } else {
+            uint8_t *entry = (uint8_t *)table + idx * entrySize;
+            memset(entry, 0, entrySize);
+            memcpy(entry, rsp, len < entrySize ? len : entrySize);
+        }
+    }
+
+    *count = end;
+
+    return 0;
+}
+
+bool NanoHubInfo::loadCache(void)
+{
+    struct NanoHubInfoCacheHeader hdr;
+    bool hit = false;
+    int fd;
+
+    fd = open(NANOHUB_INFO_CACHE_PATH, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        hdr.magic == NANOHUB_INFO_CACHE_MAGIC &&
+        hdr.version == NANOHUB_INFO_CACHE_VERSION &&
+        hdr.numApps <= NANOHUB_INFO_MAX_APPS &&
+        hdr.numSensors <= NANOHUB_INFO_MAX_SENSORS &&
+        !memcmp(&hdr.versions, &mVersions, sizeof(mVersions))) {
+        ssize_t appSize = hdr.numApps * sizeof(mApps[0]);
+        ssize_t sensorSize = hdr.numSensors * sizeof(mSensors[0]);
+        if (read(fd, mApps, appSize) == appSize &&
+            read(fd, mSensors, sensorSize) == sensorSize) {
+            mNumApps = hdr.numApps;
+            mNumSensors = hdr.numSensors;
+            hit = true;
+        }
+    }
+
+    close(fd);
+
+    return hit;
+}
+
+void NanoHubInfo::storeCache(void) const
+{
+    const char *tmpPath = NANOHUB_INFO_CACHE_PATH ".tmp";
+    struct NanoHubInfoCacheHeader hdr;
+    ssize_t appSize = mNumApps * sizeof(mApps[0]);
+    ssize_t sensorSize = mNumSensors * sizeof(mSensors[0]);
+    int fd;
+
+    hdr.magic = NANOHUB_INFO_CACHE_MAGIC;
+    hdr.version = NANOHUB_INFO_CACHE_VERSION;
+    hdr.versions = mVersions;
+    hdr.numApps = mNumApps;
+    hdr.numSensors = mNumSensors;
+
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (fd < 0) {
+        ALOGW("can't write '%s': %s", tmpPath, strerror(errno));
+        return;
+    }
+
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd, mApps, appSize) != appSize ||
+        write(fd, mSensors, sensorSize) != sensorSize) {
+        close(fd);
+        unlink(tmpPath);
+        return;
+    }
+    close(fd);
+
+    if (rename(tmpPath, NANOHUB_INFO_CACHE_PATH) < 0) {
+        unlink(tmpPath);
+    }
+}
+
+bool NanoHubInfo::hasApp(uint64_t appId) const
+{
+    for (uint32_t i = 0; i < mNumApps; i++) {
+        if (mApps[i].appId == appId) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool NanoHubInfo::providesSensor(int handle) const
+{
+    for (size_t i = 0; i < ARRAY_SIZE(sAppSensorMap); i++) {
+        if ((sAppSensorMap[i].handles & NANOHUB_HANDLE_BIT(handle)) &&
+            hasApp(sAppSensorMap[i].appId)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const struct NanohubSensorInfoResponse *NanoHubInfo::findSensor(uint8_t sensorType) const
+{
+    for (uint32_t i = 0; i < mNumSensors; i++) {
+        if (mSensors[i].sensorType == sensorType) {
+            return &mSensors[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * fillSensor: replace the guessed capabilities of a sensor_t with what the
+ * hub advertises for sensorType.
+ *
+ * Rates are in samples per 1024s. Delays are only derived for sensors
+ * with numeric rates; on-change/one-shot/on-demand entries keep their
+ * template values. The host FIFO the hub guarantees is minSamples deep.
+ */
+bool NanoHubInfo::fillSensor(struct sensor_t *sensor, uint8_t sensorType) const
+{
+    const struct NanohubSensorInfoResponse *info = findSensor(sensorType);
+    uint32_t minRate = 0, maxRate = 0, rate;
+
+    if (!info) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < info->numRates && i < NANOHUB_SENSOR_INFO_RATES_MAX; i++) {
+        rate = info->supportedRates[i];
+        if (rate == 0 || rate >= SENSOR_RATE_ONDEMAND) {
+            continue;
+        }
+        if (!minRate || rate < minRate) {
+            minRate = rate;
+        }
+        if (rate > maxRate) {
+            maxRate = rate;
+        }
+    }
+
+    if (maxRate && sensor->minDelay > 0) {
+        sensor->minDelay = (int32_t)(1024000000ULL / maxRate);
+        sensor->maxDelay = (int32_t)(1024000000ULL / minRate);
+    }
+
+    if (info->minSamples) {
+        sensor->fifoMaxEventCount = info->minSamples;
+    }
+
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_INFO_H
+#define NANOHUB_INFO_H
+
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohubPacket.h"
+#include "nanohub_comms.h"
+
+#define NANOHUB_INFO_CACHE_PATH     "/data/misc/sensors/nanohub_info.bin"
+#define NANOHUB_INFO_CACHE_MAGIC    0x4349484e  /* "NHIC" */
+#define NANOHUB_INFO_CACHE_VERSION  2
+
+#define NANOHUB_INFO_MAX_APPS       32
+#define NANOHUB_INFO_MAX_SENSORS    32
+#define NANOHUB_INFO_QUERY_DEPTH    8
+
+#define NANOHUB_APP_VENDOR_GOOGLE   0x476f6f676cULL  /* "Googl" */
+#define NANOHUB_APP_ID(vendor, seq) (((uint64_t)(vendor) << 24) | ((seq) & 0x00ffffff))
+
+/*
+ * NanoHubInfo: what the hub is running.
+ *
+ * Queried once per process. The app and sensor tables are cached on disk
+ * keyed by the hub OS/HW versions, so a warm open costs a single round
+ * trip.
+ */
+class NanoHubInfo {
+    struct NanohubOsHwVersionsResponse mVersions;
+    struct NanohubAppInfoResponse mApps[NANOHUB_INFO_MAX_APPS];
+    struct NanohubSensorInfoResponse mSensors[NANOHUB_INFO_MAX_SENSORS];
+    uint32_t mNumApps;
+    uint32_t mNumSensors;
+    bool mValid;
+
+    NanoHubInfo();
+
+    void load(void);
+    int queryVersions(NanoHubComms &comms);
+    int enumerate(NanoHubComms &comms, uint32_t reason, void *table,
+                  size_t entrySize, size_t minLen, uint32_t max, uint32_t *count);
+    bool loadCache(void);
+    void storeCache(void) const;
+
+    static void init(void);
+
+public:
+    static NanoHubInfo *getInstance(void);
+
+    bool isValid(void) const { return mValid; }
+    const struct NanohubOsHwVersionsResponse &getVersions(void) const { return mVersions; }
+    bool hasApp(uint64_t appId) const;
+    bool providesSensor(int handle) const;
+    bool hasSensorInfo(void) const { return mNumSensors > 0; }
+    const struct NanohubSensorInfoResponse *findSensor(uint8_t sensorType) const;
+    bool fillSensor(struct sensor_t *sensor, uint8_t sensorType) const;
+};
+
+#endif  // NANOHUB_INFO_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_QUAT_H
+#define NANOHUB_QUAT_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Quaternion helpers shared by the rotation vector decoder and the host
+ * fusion. Quaternions are stored the way sensors_event_t carries them,
+ * { x, y, z, w }, and rotate device coordinates into the world frame
+ * (x east, y north, z up). Matrices are row major, R[3 * row + col].
+ */
+
+/*
+ * inv_sqrt: 1/sqrt(x), bit trick estimate refined by two Newton steps,
+ * good to float precision for the near unit norms seen here.
+ */
+static inline float inv_sqrt(float x)
+{
+    float half = 0.5f * x;
+    uint32_t i;
+    float y;
+
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5f375a86 - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    y = y * (1.5f - half * y * y);
+    y = y * (1.5f - half * y * y);
+
+    return y;
+}
+
+/*
+ * quat_normalize: scale to unit length with w >= 0, the half of the
+ * double cover the framework expects. Returns false for a null vector.
+ */
+static inline bool quat_normalize(float q[4])
+{
+    float n = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+    float s;
+
+    if (!(n > 0.0f)) {
+        return false;
+    }
+
+    s = inv_sqrt(n);
+    if (q[3] < 0.0f) {
+        s = -s;
+    }
+    for (int i = 0; i < 4; i++) {
+        q[i] *= s;
+    }
+
+    return true;
+}
+
+static inline void quat_to_matrix(const float q[4], float R[9])
+{
+    float xx = q[0] * q[0], yy = q[1] * q[1], zz = q[2] * q[2];
+    float xy = q[0] * q[1], xz = q[0] * q[2], yz = q[1] * q[2];
+    float xw = q[0] * q[3], yw = q[1] * q[3], zw = q[2] * q[3];
+
+    R[0] = 1.0f - 2.0f * (yy + zz);
+    R[1] = 2.0f * (xy - zw);
+    R[2] = 2.0f * (xz + yw);
+    R[3] = 2.0f * (xy + zw);
+    R[4] = 1.0f - 2.0f * (xx + zz);
+    R[5] = 2.0f * (yz - xw);
+    R[6] = 2.0f * (xz - yw);
+    R[7] = 2.0f * (yz + xw);
+    R[8] = 1.0f - 2.0f * (xx + yy);
+}
+
+static inline void matrix_to_quat(const float R[9], float q[4])
+{
+    float t = R[0] + R[4] + R[8];
+    float s;
+
+    if (t > 0.0f) {
+        s = 0.5f * inv_sqrt(t + 1.0f);
+        q[3] = 0.25f / s;
+        q[0] = (R[7] - R[5]) * s;
+        q[1] = (R[2] - R[6]) * s;
+        q[2] = (R[3] - R[1]) * s;
+    } else if (R[0] > R[4] && R[0] > R[8]) {
+        s = 2.0f * sqrtf(1.0f + R[0] - R[4] - R[8]);
+        q[3] = (R[7] - R[5]) / s;
+        q[0] = 0.25f * s;
+        q[1] = (R[1] + R[3]) / s;
+        q[2] = (R[2] + R[6]) / s;
+    } else if (R[4] > R[8]) {
+        s = 2.0f * sqrtf(1.0f + R[4] - R[0] - R[8]);
+        q[3] = (R[2] - R[6]) / s;
+        q[0] = (R[1] + R[3]) / s;
+        q[1] = 0.25f * s;
+        q[2] = (R[5] + R[7]) / s;
+    } else {
+        s = 2.0f * sqrtf(1.0f + R[8] - R[0] - R[4]);
+        q[3] = (R[3] - R[1]) / s;
+        q[0] = (R[2] + R[6]) / s;
+        q[1] = (R[5] + R[7]) / s;
+        q[2] = 0.25f * s;
+    }
+
+    quat_normalize(q);
+}
+
+/*
+ * matrix_to_orientation: azimuth, pitch, roll in degrees with the legacy
+ * SENSOR_TYPE_ORIENTATION formulas of the framework's orientation
+ * sensor: azimuth in [0, 360), pitch in [-180, 180] and roll in
+ * [-90, 90], roll counting the other way round from
+ * SensorManager.getOrientation().
+ */
+static inline void matrix_to_orientation(const float R[9], float o[3])
+{
+    const float rad2deg = (float)(180.0 / M_PI);
+    float roll = R[6];
+
+    if (roll > 1.0f) {
+        roll = 1.0f;
+    } else if (roll < -1.0f) {
+        roll = -1.0f;
+    }
+
+    o[0] = atan2f(-R[3], R[0]) * rad2deg;
+    if (o[0] < 0.0f) {
+        o[0] += 360.0f;
+    }
+    o[1] = atan2f(-R[7], R[8]) * rad2deg;
+    o[2] = asinf(roll) * rad2deg;
+}
+
+#endif  // NANOHUB_QUAT_H
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "nanohub_reader.h"
+
+#define NANOHUB_READER_FULL_WAIT_NS 1000000    /* recheck a full arena every 1ms */
+#define NANOHUB_READER_OWED_WAIT_MS 1          /* recheck a full ring owing flushes */
+
+#define NANOHUB_READER_KICK 'K'
+#define NANOHUB_READER_STOP 'S'
+
+/*
+ * check_control: consume what was written to the control pipe, true if
+ * one of it was a stop.
+ */
+static bool check_control(int fd)
+{
+    char msg[16];
+    int n;
+
+    while ((n = read(fd, msg, sizeof(msg))) > 0) {
+        if (memchr(msg, NANOHUB_READER_STOP, n)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+NanoHubReader::NanoHubReader(NanoHub *hub, int cpu, int priority)
+    : mHub(hub), mCpu(cpu), mPriority(priority), mRunning(false)
+{
+    mArena = hub->getArena();
+    mControlFds[0] = mControlFds[1] = -1;
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        mQueues[c].head = mQueues[c].tail = 0;
+        mQueues[c].notifyFds[0] = mQueues[c].notifyFds[1] = -1;
+        mQueues[c].attached = false;
+        mQueues[c].dropped = 0;
+        memset(mQueues[c].flushOwed, 0, sizeof(mQueues[c].flushOwed));
+        mQueues[c].owing = false;
+    }
+}
+
+NanoHubReader::~NanoHubReader()
+{
+    const char stop = NANOHUB_READER_STOP;
+
+    if (mRunning) {
+        if (write(mControlFds[1], &stop, 1) < 0) {
+            ALOGE("error stopping reader (%s)", strerror(errno));
+        }
+        pthread_join(mThread, NULL);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (mControlFds[i] >= 0) {
+            close(mControlFds[i]);
+        }
+    }
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        drain(&mQueues[c]);
+        ALOGI_IF(mQueues[c].dropped, "reader: client %d missed %u batches on a full queue", c,
+                 mQueues[c].dropped);
+        for (int i = 0; i < 2; i++) {
+            if (mQueues[c].notifyFds[i] >= 0) {
+                close(mQueues[c].notifyFds[i]);
+            }
+        }
+    }
+}
+
+int NanoHubReader::start(void)
+{
+    int err;
+
+    if (pipe(mControlFds) < 0) {
+        ALOGE("error creating reader pipes (%s)", strerror(errno));
+        return -errno;
+    }
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        if (pipe(mQueues[c].notifyFds) < 0) {
+            ALOGE("error creating reader pipes (%s)", strerror(errno));
+            return -errno;
+        }
+        fcntl(mQueues[c].notifyFds[0], F_SETFL, O_NONBLOCK);
+        fcntl(mQueues[c].notifyFds[1], F_SETFL, O_NONBLOCK);
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(mControlFds[i], F_SETFL, O_NONBLOCK);
+    }
+
+    err = pthread_create(&mThread, NULL, threadMain, this);
+    if (err) {
+        ALOGE("error starting reader thread (%s)", strerror(err));
+        return -err;
+    }
+    mRunning = true;
+
+    return 0;
+}
+
+/*
+ * attach: start queueing batches for client. Whatever an earlier client
+ * in the same slot left behind is dropped first. Called under NanoHub's
+ * client lock, possibly before start().
+ */
+void NanoHubReader::attach(int client)
+{
+    drain(&mQueues[client]);
+    __atomic_store_n(&mQueues[client].attached, true, __ATOMIC_RELEASE);
+}
+
+void NanoHubReader::detach(int client)
+{
+    __atomic_store_n(&mQueues[client].attached, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * drain: drop a queue's batches, as its consumer.
+ */
+void NanoHubReader::drain(struct client_queue *q)
+{
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    while (q->head != tail) {
+        mArena->release(&q->ring[q->head & (NANOHUB_READER_RING - 1)]);
+        q->head++;
+    }
+    __atomic_store_n(&q->head, tail, __ATOMIC_RELEASE);
+}
+
+void NanoHubReader::kick(void)
+{
+    const char kick = NANOHUB_READER_KICK;
+
+    if (write(mControlFds[1], &kick, 1) < 0 && errno != EAGAIN) {
+        ALOGE("error kicking reader (%s)", strerror(errno));
+    }
+}
+
+void *NanoHubReader::threadMain(void *arg)
+{
+    NanoHubReader *reader = static_cast<NanoHubReader *>(arg);
+
+    reader->setupThread();
+    reader->run();
+
+    return NULL;
+}
+
+/*
+ * setupThread: CPU affinity and real time priority, as configured. A
+ * failure only costs latency, so it is logged and the thread carries on.
+ */
+void NanoHubReader::setupThread(void)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    if (mCpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(mCpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            ALOGW("can't pin reader to cpu %d (%s)", mCpu, strerror(errno));
+        }
+    }
+
+    if (mPriority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = mPriority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+            ALOGW("can't make reader SCHED_FIFO %d", mPriority);
+        }
+    }
+
+    ALOGI("reader thread up, cpu %d priority %d", mCpu, mPriority);
+}
+
+/*
+ * push: queue a reference to batch for one client, false if its ring is
+ * full.
+ */
+bool NanoHubReader::push(struct client_queue *q, const struct nanohub_batch *batch)
+{
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = q->tail;
+
+    if (tail - head >= NANOHUB_READER_RING) {
+        return false;
+    }
+    mArena->acquire(batch);
+    q->ring[tail & (NANOHUB_READER_RING - 1)] = *batch;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/*
+ * wants: whether batch has anything NanoHub routes to client.
+ */
+bool NanoHubReader::wants(int client, const struct nanohub_batch *batch) const
+{
+    const sensors_event_t *ev = mArena->events(batch);
+
+    for (int i = 0; i < batch->count; i++) {
+        if (mHub->routes(client, &ev[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * keepFlushes: count the flush completions batch has for client, which
+ * is missing it.
+ */
+void NanoHubReader::keepFlushes(int client, const struct nanohub_batch *batch)
+{
+    struct client_queue *q = &mQueues[client];
+    const sensors_event_t *ev = mArena->events(batch);
+
+    for (int i = 0; i < batch->count; i++) {
+        if (ev[i].type == SENSOR_TYPE_META_DATA &&
+            ev[i].meta_data.what == META_DATA_FLUSH_COMPLETE &&
+            ev[i].meta_data.sensor >= 0 && ev[i].meta_data.sensor < NANOHUB_ID_MAX &&
+            mHub->routes(client, &ev[i])) {
+            q->flushOwed[ev[i].meta_data.sensor]++;
+            q->owing = true;
+        }
+    }
+}
+
+/*
+ * pushOwed: queue the flush completions client missed, in a batch of
+ * their own, tagged for it. False while they are still owed: its ring
+ * is full or the arena has no block for them.
+ */
+bool NanoHubReader::pushOwed(int client)
+{
+    const char notify = 'N';
+    struct client_queue *q = &mQueues[client];
+    struct nanohub_batch batch;
+    sensors_event_t *ev;
+    bool pushed;
+    int n = 0, taken;
+
+    if (!q->owing) {
+        return true;
+    }
+    if (mArena->alloc(&batch) < 0) {
+        return false;
+    }
+
+    ev = mArena->events(&batch);
+    for (int h = 0; h < NANOHUB_ID_MAX; h++) {
+        for (int i = 0; i < q->flushOwed[h] && n < NANOHUB_ARENA_BLOCK_EVENTS; i++, n++) {
+            memset(&ev[n], 0, sizeof(ev[n]));
+            ev[n].version = META_DATA_VERSION;
+            ev[n].type = SENSOR_TYPE_META_DATA;
+            ev[n].reserved0 = client + 1;
+            ev[n].meta_data.what = META_DATA_FLUSH_COMPLETE;
+            ev[n].meta_data.sensor = h;
+        }
+    }
+    mArena->commit(&batch, n);
+
+    /* the ring holds its own reference */
+    pushed = push(q, &batch);
+    mArena->release(&batch);
+    if (!pushed) {
+        return false;
+    }
+
+    q->owing = false;
+    for (int h = 0; h < NANOHUB_ID_MAX; h++) {
+        taken = q->flushOwed[h] < n ? q->flushOwed[h] : n;
+        q->flushOwed[h] -= taken;
+        n -= taken;
+        q->owing |= q->flushOwed[h] != 0;
+    }
+    if (write(q->notifyFds[1], &notify, 1) < 0 && errno != EAGAIN) {
+        ALOGE("error notifying poll (%s)", strerror(errno));
+    }
+
+    return !q->owing;
+}
+
+/*
+ * settle: queue what every client is owed, once its ring has room.
+ * Whatever a client that left was owed is forgotten. True while some
+ * client is still owed completions.
+ */
+bool NanoHubReader::settle(void)
+{
+    struct client_queue *q;
+    bool owed = false;
+
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        q = &mQueues[c];
+        if (!q->owing) {
+            continue;
+        }
+        if (!__atomic_load_n(&q->attached, __ATOMIC_ACQUIRE)) {
+            memset(q->flushOwed, 0, sizeof(q->flushOwed));
+            q->owing = false;
+            continue;
+        }
+        owed |= !pushOwed(c);
+    }
+
+    return owed;
+}
+
+/*
+ * deliver: hand batch to every attached client it has events for, each
+ * one holding its own reference. A client whose ring is full misses it;
+ * waiting would stall every other client behind the slowest one. Its
+ * flush completions are kept for it, and until they are queued it
+ * misses later batches too, keeping them in order.
+ */
+void NanoHubReader::deliver(struct nanohub_batch *batch)
+{
+    const char notify = 'N';
+    struct client_queue *q;
+
+    for (int c = 0; c < NANOHUB_MAX_CLIENTS; c++) {
+        q = &mQueues[c];
+        if (!__atomic_load_n(&q->attached, __ATOMIC_ACQUIRE) || !wants(c, batch)) {
+            continue;
+        }
+
+        if (!pushOwed(c) || !push(q, batch)) {
+            keepFlushes(c, batch);
+            if (q->dropped++ == 0) {
+                ALOGW("reader: client %d queue full, dropping batches", c);
+            }
+            continue;
+        }
+        if (write(q->notifyFds[1], &notify, 1) < 0 && errno != EAGAIN) {
+            ALOGE("error notifying poll (%s)", strerror(errno));
+        }
+    }
+
+    /* drop the reference takeBatch gave us */
+    mArena->release(batch);
+}
+
+void NanoHubReader::run(void)
+{
+    struct nanohub_batch batch;
+    struct timespec wait = { 0, NANOHUB_READER_FULL_WAIT_NS };
+    struct pollfd fds[2];
+    bool owed;
+    int nb, n;
+
+    fds[0].fd = mHub->getFd();
+    fds[0].events = POLLIN;
+    fds[1].fd = mControlFds[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        owed = settle();
+        if (!mHub->hasPending()) {
+            fds[0].revents = fds[1].revents = 0;
+            n = TEMP_FAILURE_RETRY(mHub->wait(fds, 2, 0, owed ? NANOHUB_READER_OWED_WAIT_MS : -1));
+            if (n < 0) {
+                ALOGE("reader poll() failed (%s)", strerror(errno));
+                return;
+            }
+            if ((fds[1].revents & POLLIN) && check_control(mControlFds[0])) {
+                return;
+            }
+            if (!(fds[0].revents & POLLIN) && !mHub->hasPending()) {
+                continue;
+            }
+        }
+
+        /* -EAGAIN: drained, back to poll; -ENOMEM: clients hold every arena block */
+        nb = mHub->takeBatch(&batch);
+        if (nb <= 0) {
+            if (nb < 0 && nb != -EAGAIN) {
+                nanosleep(&wait, NULL);
+            }
+            continue;
+        }
+
+        deliver(&batch);
+    }
+}
+
+/*
+ * readEvents: copy the events routed to client out of its queued
+ * batches, releasing each one drained. The notification is drained
+ * first, so anything pushed after that raises it again.
+ */
+int NanoHubReader::readEvents(int client, sensors_event_t *data, int count)
+{
+    struct client_queue *q = &mQueues[client];
+    struct nanohub_batch *batch;
+    const sensors_event_t *ev;
+    char drain[16];
+    uint32_t head = q->head;
+    uint32_t tail;
+    int n = 0;
+
+    while (read(q->notifyFds[0], drain, sizeof(drain)) > 0) {
+    }
+
+    tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    while (n < count && head != tail) {
+        batch = &q->ring[head & (NANOHUB_READER_RING - 1)];
+        ev = mArena->events(batch);
+        for (; batch->count && n < count; batch->start++, batch->count--, ev++) {
+            if (mHub->routes(client, ev)) {
+                data[n] = *ev;
+                data[n].reserved0 = 0;
+                n++;
+            }
+        }
+        if (!batch->count) {
+            mArena->release(batch);
+            head++;
+        }
+    }
+
+    __atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+bool NanoHubReader::hasPending(int client) const
+{
+    return __atomic_load_n(&mQueues[client].tail, __ATOMIC_ACQUIRE) != mQueues[client].head;
+}
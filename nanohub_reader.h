@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_READER_H
+#define NANOHUB_READER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub.h"
+
+#define NANOHUB_READER_RING     (NANOHUB_ARENA_BLOCKS / 2)  /* batches, power of 2 */
+
+/*
+ * NanoHubReader: optional thread that reads and decodes the hub stream
+ * on its own, so the framework's poll() only copies decoded events out.
+ *
+ * The thread blocks on /dev/nanohub, takes decoded arena batches from
+ * NanoHub::takeBatch and pushes them into a single producer/single
+ * consumer ring per attached client; a pipe per client tells its poll
+ * side there is something to pick up. Only batch handles cross threads:
+ * every client's ring holds a reference to the same arena block, and the
+ * events are copied once, out of the arena into the framework's buffer,
+ * keeping only those NanoHub routes to that client. It can be pinned to
+ * one CPU and run SCHED_FIFO to keep decode jitter off latency sensitive
+ * streams. A batch only goes to the clients it has events for. A client
+ * whose ring is full misses the batch, which is counted, instead of
+ * holding up the others; a ring is half the arena, so one stalled client
+ * can't take every block. The flush completions it had for that client
+ * are kept, and the client misses every batch after it until they are
+ * queued, so that none is lost and none overtakes samples. When the arena is full it stops reading and
+ * the hub FIFO takes up the slack. Events NanoHub produces without the hub
+ * (cached on-change state, local flush completions) need a kick() to be
+ * picked up.
+ */
+class NanoHubReader {
+    NanoHub *mHub;
+    NanoHubEventArena *mArena;
+    int mCpu;           /* -1: any */
+    int mPriority;      /* SCHED_FIFO priority, 0: normal scheduling */
+
+    pthread_t mThread;
+    bool mRunning;
+    int mControlFds[2]; /* kick/stop -> reader */
+
+    struct client_queue {
+        struct nanohub_batch ring[NANOHUB_READER_RING];
+        uint32_t head;      /* consumer */
+        uint32_t tail;      /* producer */
+        int notifyFds[2];   /* reader -> poll */
+        bool attached;
+        uint32_t dropped;   /* batches missed on a full ring */
+        uint16_t flushOwed[NANOHUB_ID_MAX]; /* completions missed with them */
+        bool owing;
+    } mQueues[NANOHUB_MAX_CLIENTS];
+
+    static void *threadMain(void *arg);
+    void run(void);
+    void setupThread(void);
+    bool push(struct client_queue *q, const struct nanohub_batch *batch);
+    bool wants(int client, const struct nanohub_batch *batch) const;
+    void keepFlushes(int client, const struct nanohub_batch *batch);
+    bool pushOwed(int client);
+    bool settle(void);
+    void deliver(struct nanohub_batch *batch);
+    void drain(struct client_queue *q);
+
+public:
+    NanoHubReader(NanoHub *hub, int cpu, int priority);
+    ~NanoHubReader();
+
+    int start(void);
+    void kick(void);
+    bool onThread(void) const { return mRunning && pthread_equal(mThread, pthread_self()); }
+
+    void attach(int client);
+    void detach(int client);
+    int getFd(int client) const { return mQueues[client].notifyFds[0]; }
+    int readEvents(int client, sensors_event_t *data, int count);
+    bool hasPending(int client) const;
+};
+
+#endif  // NANOHUB_READER_H
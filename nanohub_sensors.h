@@ -95,6 +95,28 @@ struct TripleAxisDataEvent {
     struct TripleAxisDataPoint samples[];
 };
 
+// NUM_AXIS_THREE compressed data format, sent as EVT_NO_FIRST_COMPRESSED_SENSOR_EVENT + type
+// to hosts that set the compress bit in the sensor config
+struct TripleAxisCompressedHeader {
+    struct SensorFirstSample firstSample;
+    float scale;                            // sample value = int16 * scale
+    uint8_t deltaShift;                     // deltaTime unit is (1 << deltaShift) ns
+    uint8_t pad[3];
+} __attribute__((packed));
+
+struct TripleAxisCompressedDataPoint {
+    uint16_t deltaTime;                     // delta since last sample, unused for the 0th sample
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} __attribute__((packed));
+
+struct TripleAxisCompressedDataEvent {
+    uint64_t referenceTime;
+    struct TripleAxisCompressedHeader header;
+    struct TripleAxisCompressedDataPoint samples[];
+};
+
 // For WiFi Scan Events
 #define WIFI_MAX_SSID_LEN (32+1)
 #define WIFI_BSSID_LEN 6
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+
+#include <cutils/log.h>
+#include <utils/Timers.h>
+
+#include "nanohub_spin.h"
+
+#define NANOHUB_SPIN_RELAX 32   /* pauses between two polls */
+
+static inline void cpu_relax(void)
+{
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline int64_t spin_margin(int64_t interval)
+{
+    return interval / 16 > NANOHUB_SPIN_MIN_GUARD_NS ? interval / 16 : NANOHUB_SPIN_MIN_GUARD_NS;
+}
+
+NanoHubSpinWait::NanoHubSpinWait()
+    : mPeriod(0), mInterval(0), mGuard(0), mLastArrival(0), mLastBySpin(false),
+      mStatsStart(0), mSpinNs(0), mSpinHits(0), mSpinMisses(0)
+{
+    mLatencySum[0] = mLatencySum[1] = 0;
+    mLatencyCount[0] = mLatencyCount[1] = 0;
+}
+
+/*
+ * setPeriod: sample period of the fastest unbatched stream, 0 if none.
+ * The learnt timing restarts from it.
+ */
+void NanoHubSpinWait::setPeriod(int64_t period_ns)
+{
+    if (period_ns == mPeriod) {
+        return;
+    }
+
+    mPeriod = period_ns;
+    mInterval = period_ns;
+    mGuard = period_ns / 4;
+    if (mGuard < NANOHUB_SPIN_MIN_GUARD_NS) {
+        mGuard = NANOHUB_SPIN_MIN_GUARD_NS;
+    }
+    mLastArrival = 0;
+}
+
+/*
+ * arrived: learn the inter-arrival time (1/8 weight) from a packet
+ * arrival. Gaps far off the stream period (stream restarted, hub busy)
+ * are not learnt from.
+ */
+void NanoHubSpinWait::arrived(int64_t now, bool bySpin)
+{
+    int64_t interval = now - mLastArrival;
+
+    if (mLastArrival && interval > 0 && interval < 8 * mPeriod) {
+        mInterval += (interval - mInterval) / 8;
+    }
+    mLastArrival = now;
+    mLastBySpin = bySpin;
+}
+
+int NanoHubSpinWait::wait(struct pollfd *fds, int nfds, int hubIdx, int timeoutMs)
+{
+    struct timespec ts;
+    int64_t now, due, start, spun;
+    int n;
+
+    if (!mPeriod || timeoutMs == 0) {
+        n = poll(fds, nfds, timeoutMs);
+        if (mPeriod && n > 0 && (fds[hubIdx].revents & POLLIN)) {
+            arrived(systemTime(SYSTEM_TIME_BOOTTIME), false);
+        }
+        return n;
+    }
+
+    /* sleep until a bit before the next packet is due */
+    now = systemTime(SYSTEM_TIME_BOOTTIME);
+    due = mLastArrival + mInterval - mGuard;
+    if (mLastArrival && due > now) {
+        ts.tv_sec = (due - now) / 1000000000LL;
+        ts.tv_nsec = (due - now) % 1000000000LL;
+        n = ppoll(fds, nfds, &ts, NULL);
+        if (n != 0) {
+            if (n > 0 && (fds[hubIdx].revents & POLLIN)) {
+                arrived(systemTime(SYSTEM_TIME_BOOTTIME), false);
+            }
+            return n;
+        }
+    }
+
+    /* then spin, for a bounded time */
+    start = systemTime(SYSTEM_TIME_BOOTTIME);
+    do {
+        n = poll(fds, nfds, 0);
+        if (n != 0) {
+            break;
+        }
+        for (int i = 0; i < NANOHUB_SPIN_RELAX; i++) {
+            cpu_relax();
+        }
+        now = systemTime(SYSTEM_TIME_BOOTTIME);
+    } while (now - start < 2 * mInterval && now - start < NANOHUB_SPIN_MAX_NS);
+
+    now = systemTime(SYSTEM_TIME_BOOTTIME);
+    spun = now - start;
+    mSpinNs += spun;
+
+    if (n > 0) {
+        mSpinHits++;
+        /*
+         * The packet came spun ns into the spin; aim for a small margin
+         * (1/16 of a period) instead.
+         */
+        mGuard += (spin_margin(mInterval) - spun) / 8;
+        if (mGuard < NANOHUB_SPIN_MIN_GUARD_NS) {
+            mGuard = NANOHUB_SPIN_MIN_GUARD_NS;
+        }
+        if (fds[hubIdx].revents & POLLIN) {
+            arrived(now, true);
+        }
+        return n;
+    } else if (n < 0) {
+        return n;
+    }
+
+    /* nothing came: start earlier next time, and sleep for this one */
+    mSpinMisses++;
+    if (mGuard < mInterval) {
+        mGuard += mGuard / 4;
+    }
+    n = poll(fds, nfds, timeoutMs);
+    if (n > 0 && (fds[hubIdx].revents & POLLIN)) {
+        arrived(systemTime(SYSTEM_TIME_BOOTTIME), false);
+    }
+
+    return n;
+}
+
+/*
+ * delivered: delivery latency of the newest sample of the last packet,
+ * counted against the way the packet was waited for.
+ */
+void NanoHubSpinWait::delivered(int64_t sampleTime)
+{
+    int64_t now;
+
+    if (!mPeriod) {
+        return;
+    }
+
+    now = systemTime(SYSTEM_TIME_BOOTTIME);
+    if (now > sampleTime) {
+        mLatencySum[mLastBySpin] += now - sampleTime;
+        mLatencyCount[mLastBySpin]++;
+    }
+
+    if (!mStatsStart) {
+        mStatsStart = now;
+    } else if (now - mStatsStart >= NANOHUB_SPIN_REPORT_NS) {
+        report(now);
+    }
+}
+
+void NanoHubSpinWait::report(int64_t now)
+{
+    int64_t avg[2];
+
+    for (int i = 0; i < 2; i++) {
+        avg[i] = mLatencyCount[i] ? mLatencySum[i] / mLatencyCount[i] : 0;
+    }
+
+    ALOGI("spin: %" PRId64 " us/s cpu, %u hits %u misses, interval %" PRId64
+          " us, latency %" PRId64 " us spin / %" PRId64 " us poll",
+          mSpinNs * 1000 / (now - mStatsStart), mSpinHits, mSpinMisses,
+          mInterval / 1000, avg[1] / 1000, avg[0] / 1000);
+
+    mStatsStart = now;
+    mSpinNs = 0;
+    mSpinHits = mSpinMisses = 0;
+    mLatencySum[0] = mLatencySum[1] = 0;
+    mLatencyCount[0] = mLatencyCount[1] = 0;
+}
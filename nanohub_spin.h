@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_SPIN_H
+#define NANOHUB_SPIN_H
+
+#include <poll.h>
+#include <stdint.h>
+
+#include "nanohub_sensors.h"
+
+#define NANOHUB_SPIN_MIN_RATE       SENSOR_HZ(400)  /* slowest stream worth spinning for */
+#define NANOHUB_SPIN_MAX_NS         2000000LL       /* longest single spin */
+#define NANOHUB_SPIN_MIN_GUARD_NS   20000LL         /* start spinning at least this early */
+#define NANOHUB_SPIN_REPORT_NS      10000000000LL   /* stats period */
+
+/*
+ * NanoHubSpinWait: poll() replacement for the thread waiting on the hub.
+ *
+ * While a fast stream is delivered without batching, sleeping in poll()
+ * until the hub interrupt wakes us costs more than the sample period is
+ * worth. Packets of such a stream arrive at a steady pace, so we sleep
+ * until shortly before the next one is due and spin on nonblocking polls
+ * from there, giving up after a bounded time. The expected inter-arrival
+ * time and how early to start spinning are both learnt from the arrivals
+ * seen; with no such stream it is a plain poll().
+ *
+ * The CPU time spent spinning is reported periodically next to the
+ * delivery latency of spin and poll wakeups.
+ */
+class NanoHubSpinWait {
+    int64_t mPeriod;        /* fastest low latency stream, 0: don't spin */
+    int64_t mInterval;      /* learnt packet inter-arrival time */
+    int64_t mGuard;         /* learnt: spin this long before a packet is due */
+    int64_t mLastArrival;
+    bool mLastBySpin;
+
+    int64_t mStatsStart;
+    int64_t mSpinNs;
+    uint32_t mSpinHits;
+    uint32_t mSpinMisses;
+    int64_t mLatencySum[2]; /* by poll, by spin */
+    uint32_t mLatencyCount[2];
+
+    void arrived(int64_t now, bool bySpin);
+    void report(int64_t now);
+
+public:
+    NanoHubSpinWait();
+
+    void setPeriod(int64_t period_ns);
+    int wait(struct pollfd *fds, int nfds, int hubIdx, int timeoutMs);
+    void delivered(int64_t sampleTime);
+};
+
+#endif  // NANOHUB_SPIN_H
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+
+#include "nanohub_trace.h"
+
+enum trace_mode {
+    TRACE_OFF,
+    TRACE_JSON,
+    TRACE_FTRACE,
+};
+
+struct trace_record {
+    int64_t start;
+    int64_t end;
+    int64_t hubTime;
+    int16_t sensor;
+    uint8_t span;
+    uint16_t samples;
+};
+
+struct trace_buffer {
+    pid_t tid;
+    uint32_t count;
+    struct trace_record records[NANOHUB_TRACE_BUFFER];
+};
+
+/* by enum nanohub_trace_span */
+static const char * const sSpanNames[] = {
+    "read",
+    "decode",
+    "wait",
+    "deliver",
+    "config",
+};
+
+static pthread_once_t sTraceOnce = PTHREAD_ONCE_INIT;
+static enum trace_mode sMode = TRACE_OFF;
+static int sFd = -1;
+static pid_t sPid;
+static pthread_key_t sBufferKey;
+static __thread struct trace_buffer *tBuffer;
+
+static void flush_buffer(struct trace_buffer *buf);
+
+/*
+ * release_buffer: a thread that traced exits, its last spans go out
+ * with its buffer.
+ */
+static void release_buffer(void *arg)
+{
+    struct trace_buffer *buf = (struct trace_buffer *)arg;
+
+    flush_buffer(buf);
+    free(buf);
+    tBuffer = NULL;
+}
+
+void NanoHubTrace::init(void)
+{
+    char mode[PROPERTY_VALUE_MAX];
+
+    property_get("persist.nanohub.trace", mode, "off");
+    sPid = getpid();
+
+    if (!strcmp(mode, "json")) {
+        sFd = open(NANOHUB_TRACE_JSON_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0660);
+        if (sFd >= 0 && write(sFd, "[\n", 2) == 2 &&
+            pthread_key_create(&sBufferKey, release_buffer) == 0) {
+            sMode = TRACE_JSON;
+        }
+    } else if (!strcmp(mode, "ftrace")) {
+        sFd = open("/sys/kernel/tracing/trace_marker", O_WRONLY);
+        if (sFd < 0) {
+            sFd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY);
+        }
+        if (sFd >= 0) {
+            sMode = TRACE_FTRACE;
+        }
+    } else {
+        return;
+    }
+
+    if (sMode == TRACE_OFF) {
+        ALOGE("can't trace to %s (%s)", mode, strerror(errno));
+        if (sFd >= 0) {
+            close(sFd);
+            sFd = -1;
+        }
+        return;
+    }
+    ALOGI("tracing as %s", mode);
+}
+
+bool NanoHubTrace::enabled(void)
+{
+    pthread_once(&sTraceOnce, init);
+    return sMode != TRACE_OFF;
+}
+
+void NanoHubTrace::marker(const char *fmt, ...)
+{
+    char buf[128];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (len > 0 && write(sFd, buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1) < 0) {
+        ALOGV("trace_marker write failed (%s)", strerror(errno));
+    }
+}
+
+/*
+ * begin: start a span, returns its start time for end().
+ */
+int64_t NanoHubTrace::begin(enum nanohub_trace_span span)
+{
+    if (!enabled()) {
+        return 0;
+    }
+    if (sMode == TRACE_FTRACE) {
+        marker("B|%d|nanohub:%s", sPid, sSpanNames[span]);
+    }
+
+    return systemTime(SYSTEM_TIME_BOOTTIME);
+}
+
+/*
+ * end: close a span. sensor is -1 and hubTime 0 when they don't apply.
+ */
+void NanoHubTrace::end(enum nanohub_trace_span span, int64_t start, int sensor, int samples,
+                       int64_t hubTime)
+{
+    struct trace_record *rec;
+    int64_t now;
+
+    if (!enabled()) {
+        return;
+    }
+    now = systemTime(SYSTEM_TIME_BOOTTIME);
+
+    if (sMode == TRACE_FTRACE && span == NANOHUB_TRACE_CONFIG) {
+        marker("C|%d|nanohub:config:%d:latency_us|%" PRId64, sPid, sensor, (now - start) / 1000);
+        return;
+    } else if (sMode == TRACE_FTRACE) {
+        marker("E|%d", sPid);
+        if (sensor >= 0) {
+            marker("C|%d|nanohub:%s:%d:samples|%d", sPid, sSpanNames[span], sensor, samples);
+        }
+        if (sensor >= 0 && hubTime) {
+            marker("C|%d|nanohub:%s:%d:latency_us|%" PRId64, sPid, sSpanNames[span], sensor,
+                   (now - hubTime) / 1000);
+        }
+        return;
+    }
+
+    if (!tBuffer) {
+        tBuffer = (struct trace_buffer *)calloc(1, sizeof(*tBuffer));
+        if (!tBuffer) {
+            return;
+        }
+        tBuffer->tid = syscall(__NR_gettid);
+        pthread_setspecific(sBufferKey, tBuffer);
+    }
+
+    rec = &tBuffer->records[tBuffer->count++];
+    rec->start = start;
+    rec->end = now;
+    rec->hubTime = hubTime;
+    rec->sensor = sensor;
+    rec->span = span;
+    rec->samples = samples;
+
+    if (tBuffer->count == NANOHUB_TRACE_BUFFER) {
+        flush();
+    }
+}
+
+/*
+ * flush_buffer: append buf's spans to the JSON trace, in a single write
+ * so threads don't interleave inside a line.
+ */
+static void flush_buffer(struct trace_buffer *buf)
+{
+    static const size_t lineMax = 320;
+    const struct trace_record *rec;
+    char *out;
+    size_t len = 0;
+    int n;
+
+    if (sMode != TRACE_JSON || !buf || !buf->count) {
+        return;
+    }
+
+    out = (char *)malloc(buf->count * lineMax);
+    if (!out) {
+        buf->count = 0;
+        return;
+    }
+
+    for (uint32_t i = 0; i < buf->count; i++) {
+        rec = &buf->records[i];
+        n = snprintf(out + len, lineMax,
+                     "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                     "\"ts\":%" PRId64 ".%03d,\"dur\":%" PRId64 ".%03d,"
+                     "\"args\":{\"sensor\":%d,\"samples\":%d,\"hub_ts\":%" PRId64 ","
+                     "\"latency_us\":%" PRId64 "}},\n",
+                     sSpanNames[rec->span], sPid, buf->tid,
+                     rec->start / 1000, (int)(rec->start % 1000),
+                     (rec->end - rec->start) / 1000, (int)((rec->end - rec->start) % 1000),
+                     rec->sensor, rec->samples, rec->hubTime,
+                     rec->hubTime ? (rec->end - rec->hubTime) / 1000 : 0);
+        if (n > 0) {
+            len += (size_t)n < lineMax ? n : lineMax - 1;
+        }
+    }
+
+    if (write(sFd, out, len) < 0) {
+        ALOGE("trace write failed (%s)", strerror(errno));
+    }
+    free(out);
+    buf->count = 0;
+}
+
+/*
+ * flush: write out the calling thread's spans now. Every other thread's
+ * go out when its buffer fills up or the thread exits.
+ */
+void NanoHubTrace::flush(void)
+{
+    flush_buffer(tBuffer);
+}
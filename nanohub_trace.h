@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_TRACE_H
+#define NANOHUB_TRACE_H
+
+#include <stdint.h>
+
+#define NANOHUB_TRACE_JSON_PATH     "/data/misc/sensors/nanohub_trace.json"
+#define NANOHUB_TRACE_BUFFER        256     /* spans kept per thread before a flush */
+
+enum nanohub_trace_span {
+    NANOHUB_TRACE_READ,     /* one packet read from /dev/nanohub */
+    NANOHUB_TRACE_DECODE,   /* processEvent() of that packet */
+    NANOHUB_TRACE_WAIT,     /* pollEvents() blocked */
+    NANOHUB_TRACE_DELIVER,  /* events copied out to the framework */
+    NANOHUB_TRACE_CONFIG,   /* config write until the hub acknowledged it */
+};
+
+/*
+ * NanoHubTrace: optional timeline of the read -> decode -> deliver path.
+ *
+ * persist.nanohub.trace selects the output:
+ *   json    spans go to a buffer owned by the calling thread, so no locks
+ *           are taken, and each full buffer, or what is left in it when
+ *           the thread exits, is appended to
+ *           NANOHUB_TRACE_JSON_PATH in Chrome trace format (load it in
+ *           Perfetto or chrome://tracing; the closing ] is optional);
+ *   ftrace  begin/end markers and per sensor counters are written to
+ *           trace_marker as they happen, to line up with kernel and
+ *           atrace events in a systrace/Perfetto capture. Config
+ *           writes overlap, so they only show up as a latency counter.
+ * Spans carry the sensor, the number of samples, the hub timestamp of
+ * the samples and how long after it they were handled. With tracing off,
+ * enabled() is the only cost.
+ */
+class NanoHubTrace {
+    static void init(void);
+    static void marker(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+public:
+    static bool enabled(void);
+    static int64_t begin(enum nanohub_trace_span span);
+    static void end(enum nanohub_trace_span span, int64_t start, int sensor, int samples,
+                    int64_t hubTime);
+    static void flush(void);
+};
+
+#endif  // NANOHUB_TRACE_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "NANOHUB"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <utils/Timers.h>
+
+#include "nanohub_handles.h"
+#include "nanohub_trace.h"
+#include "nanohub_txn.h"
+
+NanoHubConfigTxn::NanoHubConfigTxn()
+{
+    mNumInFlight = 0;
+    mFailed = 0;
+    mCompleted = 0;
+    mLatencySum = 0;
+    mLatencyMax = 0;
+}
+
+int NanoHubConfigTxn::send(struct txn *t)
+{
+    t->sent = systemTime(SYSTEM_TIME_BOOTTIME);
+
+    return mComms.send(NANOHUB_REASON_WRITE_EVENT, t->data, t->len, &t->seq);
+}
+
+void NanoHubConfigTxn::drop(uint32_t idx)
+{
+    mInFlight[idx] = mInFlight[--mNumInFlight];
+}
+
+/*
+ * failAll: the hub stopped answering, fail whatever it still owes us.
+ */
+void NanoHubConfigTxn::failAll(int err)
+{
+    ALOGE("config: no answer for %u requests (%s)", mNumInFlight, strerror(-err));
+    for (uint32_t i = 0; i < mNumInFlight; i++) {
+        mFailed |= NANOHUB_HANDLE_BIT(mInFlight[i].handle);
+    }
+    mNumInFlight = 0;
+}
+
+/*
+ * submit: send config, a NanohubWriteEventRequest (event type first) for
+ * handle, without waiting for the hub to answer. Only waits when
+ * NANOHUB_TXN_DEPTH writes are already outstanding.
+ */
+int NanoHubConfigTxn::submit(int handle, const void *config, uint8_t len)
+{
+    struct txn *t;
+    int err;
+
+    while (mNumInFlight == NANOHUB_TXN_DEPTH) {
+        err = reap(NANOHUB_COMMS_TIMEOUT_MS);
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    t = &mInFlight[mNumInFlight];
+    t->handle = handle;
+    t->retries = 0;
+    t->len = len;
+    memcpy(t->data, config, len);
+
+    err = send(t);
+    if (err < 0) {
+        return err;
+    }
+    mNumInFlight++;
+
+    return 0;
+}
+
+/*
+ * reap: wait up to timeoutMs for one answer and settle the request it is
+ * for. Answers to requests no longer in flight are ignored. With no
+ * timeout, nothing there yet is -ETIMEDOUT and fails nothing.
+ */
+int NanoHubConfigTxn::reap(int timeoutMs)
+{
+    struct NanohubWriteEventResponse rsp;
+    uint32_t seq, reason, i;
+    uint8_t len = sizeof(rsp);
+    int64_t latency;
+    struct txn *t;
+    int err;
+
+    err = mComms.recv(&seq, &reason, &rsp, &len, timeoutMs);
+    if (err == -ETIMEDOUT && !timeoutMs) {
+        return err;
+    } else if (err < 0) {
+        failAll(err);
+        return err;
+    }
+
+    for (i = 0; i < mNumInFlight && mInFlight[i].seq != seq; i++) {
+    }
+    if (i == mNumInFlight) {
+        return 0;
+    }
+    t = &mInFlight[i];
+    latency = systemTime(SYSTEM_TIME_BOOTTIME) - t->sent;
+
+    if (reason == NANOHUB_REASON_NAK_BUSY && t->retries < NANOHUB_TXN_RETRIES) {
+        t->retries++;
+        if (send(t) == 0) {
+            return 0;
+        }
+    }
+
+    if (reason != NANOHUB_REASON_WRITE_EVENT || !len || !rsp.accepted) {
+        ALOGE("config: handle %d seq %u refused (reason 0x%08x)", t->handle, seq, reason);
+        mFailed |= NANOHUB_HANDLE_BIT(t->handle);
+    } else {
+        ALOGV("config: handle %d seq %u applied in %" PRId64 " us", t->handle, seq,
+              latency / 1000);
+    }
+
+    NanoHubTrace::end(NANOHUB_TRACE_CONFIG, t->sent, t->handle, 1, 0);
+    mCompleted++;
+    mLatencySum += latency;
+    if (latency > mLatencyMax) {
+        mLatencyMax = latency;
+    }
+    if (mCompleted == NANOHUB_TXN_REPORT) {
+        ALOGD("config: %u requests, latency avg %" PRId64 " us max %" PRId64 " us",
+              mCompleted, mLatencySum / mCompleted / 1000, mLatencyMax / 1000);
+        mCompleted = 0;
+        mLatencySum = 0;
+        mLatencyMax = 0;
+    }
+
+    drop(i);
+
+    return 0;
+}
+
+/*
+ * complete: wait for every submitted config to be answered. Returns 0 if
+ * the hub applied all of them, else -EIO with the handles that failed
+ * since the last call in *failed.
+ */
+int NanoHubConfigTxn::complete(uint64_t *failed)
+{
+    while (mNumInFlight) {
+        if (reap(NANOHUB_COMMS_TIMEOUT_MS) < 0) {
+            break;
+        }
+    }
+
+    *failed = mFailed;
+    mFailed = 0;
+
+    return *failed ? -EIO : 0;
+}
+
+/*
+ * collect: complete() without waiting. Settles the answers that already
+ * came in; requests older than NANOHUB_COMMS_TIMEOUT_MS the hub still
+ * owes fail as in complete(), the others stay in flight.
+ */
+int NanoHubConfigTxn::collect(uint64_t *failed)
+{
+    int64_t now;
+    uint32_t i;
+
+    while (mNumInFlight && reap(0) == 0) {
+    }
+
+    now = systemTime(SYSTEM_TIME_BOOTTIME);
+    for (i = 0; i < mNumInFlight; i++) {
+        if (now - mInFlight[i].sent >= NANOHUB_COMMS_TIMEOUT_MS * 1000000LL) {
+            failAll(-ETIMEDOUT);
+            break;
+        }
+    }
+
+    *failed = mFailed;
+    mFailed = 0;
+
+    return *failed ? -EIO : 0;
+}
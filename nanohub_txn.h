@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_TXN_H
+#define NANOHUB_TXN_H
+
+#include <stdint.h>
+
+#include "nanohub_comms.h"
+
+#define NANOHUB_TXN_DEPTH       8   /* config writes in flight */
+#define NANOHUB_TXN_RETRIES     2   /* resends after NAK_BUSY */
+#define NANOHUB_TXN_REPORT      64  /* log latency stats every this many */
+
+/*
+ * NanoHubConfigTxn: sensor config writes the hub acknowledges.
+ *
+ * A write() to /dev/nanohub only says the driver queued the config.
+ * Sent as NANOHUB_REASON_WRITE_EVENT over the comms node instead, each
+ * config gets a sequence number, and the hub answers with
+ * NanohubWriteEventResponse.accepted or a NAK. Writes are pipelined:
+ * submit() doesn't wait, up to NANOHUB_TXN_DEPTH can be outstanding,
+ * and complete() collects the answers of everything submitted, so a
+ * config change touching several streams costs one round trip. Callers
+ * that can't wait (the poll thread) use collect() instead, which only
+ * settles the answers already there. A NAK_BUSY is resent, a rejected
+ * config or a hub that stops answering fails the handles involved.
+ *
+ * Completion latency is tracked per request, logged as a summary and,
+ * when tracing, recorded as a span per config.
+ *
+ * Callers serialize on the HAL config lock.
+ */
+class NanoHubConfigTxn {
+    struct txn {
+        uint32_t seq;
+        int handle;
+        int64_t sent;
+        uint8_t retries;
+        uint8_t len;
+        uint8_t data[NANOHUB_PACKET_PAYLOAD_MAX];
+    } mInFlight[NANOHUB_TXN_DEPTH];
+    uint32_t mNumInFlight;
+    uint64_t mFailed;
+
+    NanoHubComms mComms;
+
+    uint32_t mCompleted;
+    int64_t mLatencySum;
+    int64_t mLatencyMax;
+
+    int send(struct txn *t);
+    int reap(int timeoutMs);
+    void drop(uint32_t idx);
+    void failAll(int err);
+
+public:
+    NanoHubConfigTxn();
+
+    bool isOpen(void) const { return mComms.isOpen(); }
+    int submit(int handle, const void *config, uint8_t len);
+    int complete(uint64_t *failed);
+    int collect(uint64_t *failed);
+    bool pending(void) const { return mNumInFlight != 0; }
+};
+
+#endif  // NANOHUB_TXN_H
@@ -25,12 +25,14 @@
 #include <pthread.h>
 #include <stdlib.h>
 
+#include <cutils/properties.h>
 #include <utils/Atomic.h>
 #include <utils/Log.h>
 
 #include <hardware/sensors.h>
 
 #include "nanohub.h"
+#include "nanohub_info.h"
 #include "sensors.h"
 
 /*****************************************************************************/
@@ -43,6 +45,12 @@
 #define RANGE_A                     (8*GRAVITY_EARTH)
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
+/*
+ * Advertised when the hub can't be asked what it has: the accelerometer
+ * through the step counter, which every nanohub build provides.
+ */
+#define NANOHUB_FALLBACK_SENSORS ((NANOHUB_HANDLE_BIT(NANOHUB_SC) << 1) - 1)
+
 static const struct sensor_t sSensorList[] = {
     {.name =       "Accelerometer Sensor",
      .vendor =     "Google Inc.",
@@ -231,9 +239,408 @@ static const struct sensor_t sSensorList[] = {
      .flags = SENSOR_FLAG_ON_CHANGE_MODE,
      .reserved =          {}
     },
+    {.name =       "WiFi Scan",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_WIFI,
+     .type =       SENSOR_TYPE_NANOHUB_WIFI_SCAN,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.0f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_WIFI_SCAN,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_SPECIAL_REPORTING_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Gyroscope Uncalibrated",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_GYRO_UNCAL,
+     .type =       SENSOR_TYPE_GYROSCOPE_UNCALIBRATED,
+     .maxRange =   40.0f,
+     .resolution = CONVERT_GYRO,
+     .power =      6.1f,
+     .minDelay =   5000,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   20,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =      200000,
+     .flags = SENSOR_FLAG_CONTINUOUS_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Magnetic field Uncalibrated",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_MAG_UNCAL,
+     .type =       SENSOR_TYPE_MAGNETIC_FIELD_UNCALIBRATED,
+     .maxRange =   200.0f,
+     .resolution = CONVERT_M,
+     .power =      5.0f,
+     .minDelay =   20000,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   20,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =      200000,
+     .flags = SENSOR_FLAG_CONTINUOUS_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Any Motion",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_ANY_MOTION,
+     .type =       SENSOR_TYPE_NANOHUB_ANY_MOTION,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_ANY_MOTION,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "No Motion",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_NO_MOTION,
+     .type =       SENSOR_TYPE_NANOHUB_NO_MOTION,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_NO_MOTION,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Significant Motion",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_SIG_MOTION,
+     .type =       SENSOR_TYPE_SIGNIFICANT_MOTION,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   -1,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ONE_SHOT_MODE | SENSOR_FLAG_WAKE_UP,
+     .reserved =          {}
+    },
+    {.name =       "Flat",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_FLAT,
+     .type =       SENSOR_TYPE_NANOHUB_FLAT,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_FLAT,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Pressure Sensor",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_BARO,
+     .type =       SENSOR_TYPE_PRESSURE,
+     .maxRange =   1100.0f,
+     .resolution = 0.01f,
+     .power =      0.5f,
+     .minDelay =   40000,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   300,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           1000000,
+     .flags = SENSOR_FLAG_CONTINUOUS_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Ambient Temperature",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_TEMP,
+     .type =       SENSOR_TYPE_AMBIENT_TEMPERATURE,
+     .maxRange =   85.0f,
+     .resolution = 0.01f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Light Sensor",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_ALS,
+     .type =       SENSOR_TYPE_LIGHT,
+     .maxRange =   43000.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Proximity Sensor",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_PROX,
+     .type =       SENSOR_TYPE_PROXIMITY,
+     .maxRange =   5.0f,
+     .resolution = 5.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE | SENSOR_FLAG_WAKE_UP,
+     .reserved =          {}
+    },
+    {.name =       "Heart Rate ECG",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_HR_ECG,
+     .type =       SENSOR_TYPE_HEART_RATE,
+     .maxRange =   250.0f,
+     .resolution = 1.0f,
+     .power =      1.0f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = SENSOR_PERMISSION_BODY_SENSORS,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Heart Rate PPG",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_HR_PPG,
+     .type =       SENSOR_TYPE_HEART_RATE,
+     .maxRange =   250.0f,
+     .resolution = 1.0f,
+     .power =      1.0f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = SENSOR_PERMISSION_BODY_SENSORS,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Gesture",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_GESTURE,
+     .type =       SENSOR_TYPE_NANOHUB_GESTURE,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   -1,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_GESTURE,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ONE_SHOT_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Tilt Detector",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_TILT,
+     .type =       SENSOR_TYPE_TILT_DETECTOR,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_SPECIAL_REPORTING_MODE | SENSOR_FLAG_WAKE_UP,
+     .reserved =          {}
+    },
+    {.name =       "Double Twist",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_DOUBLE_TWIST,
+     .type =       SENSOR_TYPE_NANOHUB_DOUBLE_TWIST,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_DOUBLE_TWIST,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_SPECIAL_REPORTING_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Double Tap",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_DOUBLE_TAP,
+     .type =       SENSOR_TYPE_NANOHUB_DOUBLE_TAP,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_DOUBLE_TAP,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_SPECIAL_REPORTING_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Window Orientation",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_WIN_ORIEN,
+     .type =       SENSOR_TYPE_NANOHUB_WIN_ORIENTATION,
+     .maxRange =   3.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_WIN_ORIENTATION,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Hall Effect Sensor",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_HALL,
+     .type =       SENSOR_TYPE_NANOHUB_HALL,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_HALL,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Activity Recognition",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_ACTIVITY,
+     .type =       SENSOR_TYPE_NANOHUB_ACTIVITY,
+     .maxRange =   255.0f,
+     .resolution = 1.0f,
+     .power =      0.1f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_ACTIVITY,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_ON_CHANGE_MODE,
+     .reserved =          {}
+    },
+    {.name =       "Display Vsync",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_VSYNC,
+     .type =       SENSOR_TYPE_NANOHUB_VSYNC,
+     .maxRange =   1.0f,
+     .resolution = 1.0f,
+     .power =      0.0f,
+     .minDelay =   0,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   0,
+     .stringType =         SENSOR_STRING_TYPE_NANOHUB_VSYNC,
+     .requiredPermission = 0,
+     .maxDelay =           0,
+     .flags = SENSOR_FLAG_SPECIAL_REPORTING_MODE,
+     .reserved =          {}
+    },
 };
 
 static struct sensor_t *Ssensor_list_ = NULL;
+static int Ssensor_count_ = 0;
+static pthread_once_t Ssensor_list_once_ = PTHREAD_ONCE_INIT;
+
+/*
+ * Keep the sensors the hub firmware actually provides, with the delays and
+ * FIFO depth it advertises in its SensorInfo. Firmware that can't report
+ * SensorInfo is matched by app instead, and when the hub can't be queried
+ * at all the whole static list is advertised. Virtual sensors the hub
+ * can't fuse are kept when the host fuses them instead.
+ */
+static void nanohub_build_sensors_list(void)
+{
+    NanoHubInfo *info = NanoHubInfo::getInstance();
+    struct sensor_t *sensor;
+
+    Ssensor_list_ = (struct sensor_t *)calloc(ARRAY_SIZE(sSensorList), sizeof(struct sensor_t));
+    if (!Ssensor_list_) {
+        return;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(sSensorList); i++) {
+        sensor = &Ssensor_list_[Ssensor_count_];
+        *sensor = sSensorList[i];
+
+        if (!info->isValid()) {
+            if (NANOHUB_FALLBACK_SENSORS & NANOHUB_HANDLE_BIT(sensor->handle)) {
+                Ssensor_count_++;
+            }
+        } else if (info->hasSensorInfo()) {
+            if (info->fillSensor(sensor, handle_to_nanohub_type(sensor->handle))) {
+                Ssensor_count_++;
+            } else if (NanoHubFusion::useHostFusion(sensor->handle)) {
+                Ssensor_count_++;
+            }
+        } else if (info->providesSensor(sensor->handle) ||
+                   NanoHubFusion::useHostFusion(sensor->handle)) {
+            Ssensor_count_++;
+        }
+    }
+
+    ALOGI("advertising %d of %zu sensors", Ssensor_count_, ARRAY_SIZE(sSensorList));
+}
 
 static int nanohub_open_sensors(const struct hw_module_t *module,
                                 const char *id,
@@ -241,8 +648,14 @@ static int nanohub_open_sensors(const struct hw_module_t *module,
 static int nanohub_get_sensors_list(struct sensors_module_t*,
         struct sensor_t const** list)
 {
-    *list = sSensorList;
-    return ARRAY_SIZE(sSensorList);
+    pthread_once(&Ssensor_list_once_, nanohub_build_sensors_list);
+    if (!Ssensor_list_) {
+        *list = sSensorList;
+        return ARRAY_SIZE(sSensorList);
+    }
+
+    *list = Ssensor_list_;
+    return Ssensor_count_;
 }
 
 static struct hw_module_methods_t nanohub_sensors_methods = {
@@ -288,12 +701,6 @@ nanohub_sensors_poll_context_t::nanohub_sensors_poll_context_t(
      * Find the iio:deviceX with name "cros_ec_ring"
      * Open /dev/iio:deviceX, enable buffer.
      */
-    mSensor = new NanoHub();
-
-    mPollFds[nanohubBufFd].fd = mSensor->getFd();
-    mPollFds[nanohubBufFd].events = POLLIN;
-    mPollFds[nanohubBufFd].revents = 0;
-
     int wakeFds[2];
     int result = pipe(wakeFds);
     ALOGE_IF(result < 0, "error creating wake pipe (%s)", strerror(errno));
@@ -304,16 +711,32 @@ nanohub_sensors_poll_context_t::nanohub_sensors_poll_context_t(
     mPollFds[nanohubWakeFd].fd = wakeFds[0];
     mPollFds[nanohubWakeFd].events = POLLIN;
     mPollFds[nanohubWakeFd].revents = 0;
+
+    /*
+     * Every open shares the one hub; this one is a client of it. The hub
+     * or, once several opens share it, our queue on its reader is polled.
+     */
+    struct sensor_t const *list;
+    int count = nanohub_get_sensors_list(NULL, &list);
+    mSensor = NanoHub::acquire(list, count);
+    mClient = mSensor->attach(mWritePipeFd);
+
+    mPollFds[nanohubBufFd].fd = mSensor->getFd();
+    mPollFds[nanohubBufFd].events = POLLIN;
+    mPollFds[nanohubBufFd].revents = 0;
 }
 
 nanohub_sensors_poll_context_t::~nanohub_sensors_poll_context_t() {
-    delete mSensor;
+    if (mClient >= 0) {
+        mSensor->detach(mClient);
+    }
+    NanoHub::put(mSensor);
     close(mPollFds[nanohubWakeFd].fd);
     close(mWritePipeFd);
 }
 
 int nanohub_sensors_poll_context_t::activate(int handle, int enabled) {
-    int err = mSensor->activate(handle, enabled);
+    int err = mSensor->activate(mClient, handle, enabled);
 
     if (enabled && !err) {
         const char wakeMessage(WAKE_MESSAGE);
@@ -329,16 +752,53 @@ int nanohub_sensors_poll_context_t::setDelay(int /* handle */,
     return 0;
 }
 
+bool nanohub_sensors_poll_context_t::hasPending(void) const
+{
+    return mSensor->hasPending(mClient);
+}
+
+int nanohub_sensors_poll_context_t::readEvents(sensors_event_t* data, int count)
+{
+    return mSensor->readEvents(mClient, data, count);
+}
+
+/*
+ * pollEvents: runs between enter() and leave() on the hub, so that close
+ * can wake it up and wait for it to be gone; nothing of the context is
+ * touched after leave().
+ */
 int nanohub_sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
 {
     int nbEvents = 0;
     int n = 0;
+    int fd;
+
+    if (!mSensor->enter(mClient)) {
+        return 0;
+    }
+
     do {
+        // the reader may have taken the hub over since the last round
+        fd = mSensor->getPollFd(mClient);
+        if (mPollFds[nanohubBufFd].fd != fd) {
+            mPollFds[nanohubBufFd].fd = fd;
+            mPollFds[nanohubBufFd].revents = 0;
+        }
+
         // see if we have some leftover from the last poll()
-        if (mPollFds[nanohubBufFd].revents & POLLIN) {
-            int nb = mSensor->readEvents(data, count);
+        if ((mPollFds[nanohubBufFd].revents & POLLIN) || hasPending()) {
+            int64_t start = NanoHubTrace::begin(NANOHUB_TRACE_DELIVER);
+            int nb = readEvents(data, count);
+            if (start) {
+                NanoHubTrace::end(NANOHUB_TRACE_DELIVER, start, nb > 0 ? data[nb - 1].sensor : -1,
+                                  nb, nb > 0 ? data[nb - 1].timestamp : 0);
+            }
+            if (nb < 0) {
+                // a real error, NanoHub logged it and is recovering
+                nb = 0;
+            }
             if (nb < count) {
-                // no more data for this sensor
+                // no more data for this sensor: the hub fd read to EAGAIN
                 mPollFds[nanohubBufFd].revents = 0;
             }
             count -= nb;
@@ -350,13 +810,19 @@ int nanohub_sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
             // we still have some room, so try to see if we can get
             // some events immediately or just wait if we don't have
             // anything to return
+            int64_t start = nbEvents ? 0 : NanoHubTrace::begin(NANOHUB_TRACE_WAIT);
             do {
-                TEMP_FAILURE_RETRY(n = poll(mPollFds, numFds,
-                                            nbEvents ? 0 : -1));
+                TEMP_FAILURE_RETRY(n = mSensor->wait(mClient, mPollFds, numFds, nanohubBufFd,
+                                                     nbEvents ? 0 : -1));
             } while (n < 0 && errno == EINTR);
+            if (start) {
+                NanoHubTrace::end(NANOHUB_TRACE_WAIT, start, -1, 0, 0);
+            }
             if (n < 0) {
-                ALOGE("poll() failed (%s)", strerror(errno));
-                return -errno;
+                int err = errno;
+                ALOGE("poll() failed (%s)", strerror(err));
+                mSensor->leave(mClient);
+                return -err;
             }
             if (mPollFds[nanohubWakeFd].revents & POLLIN) {
                 char msg(WAKE_MESSAGE);
@@ -370,6 +836,8 @@ int nanohub_sensors_poll_context_t::pollEvents(sensors_event_t* data, int count)
         }
         // if we have events and space, go read them
     } while (n && count > 10);
+
+    mSensor->leave(mClient);
     return nbEvents;
 }
 
@@ -377,13 +845,13 @@ int nanohub_sensors_poll_context_t::batch(int handle, int /* flags */,
         int64_t sampling_period_ns,
         int64_t max_report_latency_ns)
 {
-    return mSensor->batch(handle, sampling_period_ns,
+    return mSensor->batch(mClient, handle, sampling_period_ns,
                           max_report_latency_ns);
 }
 
 int nanohub_sensors_poll_context_t::flush(int handle)
 {
-    return mSensor->flush(handle);
+    return mSensor->flush(mClient, handle);
 }
 
 
@@ -440,8 +908,16 @@ static int nanohub_open_sensors(
         const struct hw_module_t* module, const char*,
         struct hw_device_t** device)
 {
+    pthread_once(&Ssensor_list_once_, nanohub_build_sensors_list);
+
     nanohub_sensors_poll_context_t *dev = new nanohub_sensors_poll_context_t(module);
 
+    if (!dev->isOpen()) {
+        ALOGE("too many opens of the sensors HAL");
+        dev->device.common.close(&dev->device.common);
+        return -EBUSY;
+    }
+
     *device = &dev->device.common;
 
     return 0;
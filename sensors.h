@@ -38,6 +38,7 @@ struct nanohub_sensors_poll_context_t {
     sensors_poll_device_1_t device; // must be first
 
     nanohub_sensors_poll_context_t(const struct hw_module_t *module);
+    bool isOpen(void) const { return mClient >= 0; }
 
     private:
     enum {
@@ -46,13 +47,17 @@ struct nanohub_sensors_poll_context_t {
         numFds,
     };
 
-    static const char WAKE_MESSAGE = 'W';
+    static const char WAKE_MESSAGE = NANOHUB_WAKE_MESSAGE;
     struct pollfd mPollFds[numFds];
     int mWritePipeFd;
-    NanoHub *mSensor;
+    NanoHub *mSensor;           /* shared with every other open */
+    int mClient;                /* our slot on mSensor, < 0: none left */
 
     ~nanohub_sensors_poll_context_t();
 
+    bool hasPending(void) const;
+    int readEvents(sensors_event_t* data, int count);
+
     int activate(int handle, int enabled);
     int setDelay(int handle, int64_t ns);
     int pollEvents(sensors_event_t* data, int count);
@@ -0,0 +1,57 @@
+# Copyright (C) 2016 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+
+LOCAL_PATH := $(call my-dir)
+
+
+# HAL core against a fake /dev/nanohub (fake_nanohub.h)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := nanohub_hal_tests
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+  nanohub_cal_test.cpp  \
+  nanohub_read_test.cpp  \
+  nanohub_reader_test.cpp  \
+  nanohub_stress_test.cpp  \
+  $(addprefix ../,$(nanohub_hal_src_files))
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libdl
+
+include $(BUILD_NATIVE_TEST)
+
+
+# Host fusion cost, run by hand: nanohub_fusion_benchmark [seconds]
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := nanohub_fusion_benchmark
+
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_SRC_FILES := \
+  nanohub_fusion_benchmark.cpp  \
+  $(addprefix ../,$(nanohub_hal_src_files))
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/.. hardware/libhardware/include
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils libutils
+
+include $(BUILD_HOST_EXECUTABLE)
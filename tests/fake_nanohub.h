@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NANOHUB_FAKE_NANOHUB_H
+#define NANOHUB_FAKE_NANOHUB_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <hardware/sensors.h>
+
+#include "eventnums.h"
+#include "nanohub.h"
+#include "nanohub_handles.h"
+#include "sensType.h"
+
+#define FAKE_NANOHUB_POLL_MS    10      /* hub thread rechecks mStop */
+
+/* what the fake hub streams */
+static const struct sensor_t sFakeSensors[] = {
+    {.name =       "Accelerometer",
+     .vendor =     "Google Inc.",
+     .version =    1,
+     .handle =     NANOHUB_ACCEL,
+     .type =       SENSOR_TYPE_ACCELEROMETER,
+     .maxRange =   156.8f,
+     .resolution = 0.0005f,
+     .power =      0.17f,
+     .minDelay =   5000,
+     .fifoReservedEventCount = 0,
+     .fifoMaxEventCount =   3000,
+     .stringType =         0,
+     .requiredPermission = 0,
+     .maxDelay =      200000,
+     .flags = SENSOR_FLAG_CONTINUOUS_MODE,
+     .reserved =          {}
+    },
+};
+
+/*
+ * FakeNanoHub: stands in for /dev/nanohub. A SOCK_SEQPACKET pair keeps
+ * one packet per read() like the driver does; the HAL gets one end as
+ * its nonblocking data fd, the hub thread owns the other. The thread
+ * swallows config writes, keeping the last accel one, answers flushes
+ * with a flush marker and, when streaming, sends an accel batch every
+ * round. A flush marker is never dropped for want of room.
+ */
+class FakeNanoHub {
+public:
+    FakeNanoHub() : mHalFd(-1), mHubFd(-1), mStarted(false), mStop(false), mStream(false),
+                    mTime(0), mConfigs(0), mAccelSeen(false)
+    {
+        int fds[2];
+
+        pthread_mutex_init(&mLock, NULL);
+        memset(&mAccelConfig, 0, sizeof(mAccelConfig));
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0) {
+            mHalFd = fds[0];
+            mHubFd = fds[1];
+            fcntl(mHalFd, F_SETFL, fcntl(mHalFd, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    ~FakeNanoHub()
+    {
+        stop();
+        if (mHubFd >= 0) {
+            close(mHubFd);
+        }
+        pthread_mutex_destroy(&mLock);
+    }
+
+    /* the HAL's end; NanoHub closes it */
+    int halFd(void) const { return mHalFd; }
+    int hubFd(void) const { return mHubFd; }
+    int configs(void) const { return __atomic_load_n(&mConfigs, __ATOMIC_ACQUIRE); }
+
+    int start(bool stream)
+    {
+        mStream = stream;
+        mStarted = pthread_create(&mThread, NULL, run, this) == 0;
+        return mStarted ? 0 : -1;
+    }
+
+    void stop(void)
+    {
+        if (mStarted) {
+            __atomic_store_n(&mStop, true, __ATOMIC_RELEASE);
+            pthread_join(mThread, NULL);
+            mStarted = false;
+        }
+    }
+
+    /* one accel packet with numSamples samples and numFlushes markers */
+    int sendAccel(int numSamples, int numFlushes)
+    {
+        return sendAccel(numSamples, numFlushes, MSG_DONTWAIT);
+    }
+
+    /* what the hub was last told to do with accel; false if nothing */
+    bool lastAccelConfig(struct sensor_config *config)
+    {
+        bool seen;
+
+        pthread_mutex_lock(&mLock);
+        seen = mAccelSeen;
+        *config = mAccelConfig;
+        pthread_mutex_unlock(&mLock);
+
+        return seen;
+    }
+
+private:
+    int mHalFd;
+    int mHubFd;
+    pthread_t mThread;
+    pthread_mutex_t mLock;
+    bool mStarted;
+    bool mStop;
+    bool mStream;
+    uint64_t mTime;
+    int mConfigs;
+    struct sensor_config mAccelConfig;
+    bool mAccelSeen;
+
+    int sendAccel(int numSamples, int numFlushes, int flags)
+    {
+        struct NanohubReadEventResponse rsp;
+        struct EvtPacket *packet = (struct EvtPacket *)&rsp;
+        size_t len = offsetof(struct EvtPacket, triple) +
+                     (numSamples ? numSamples : 1) * sizeof(struct TripleAxisDataPoint);
+
+        memset(&rsp, 0, sizeof(rsp));
+        packet->sensType = EVT_NO_FIRST_SENSOR_EVENT + SENS_TYPE_ACCEL;
+        packet->referenceTime = mTime += 1000000;
+        for (int i = 0; i < numSamples; i++) {
+            if (i) {
+                packet->triple[i].deltaTime = 1000000;
+                mTime += 1000000;
+            }
+            packet->triple[i].z = 9.81f;
+        }
+        packet->firstSample.numSamples = numSamples;
+        packet->firstSample.numFlushes = numFlushes;
+
+        return send(mHubFd, &rsp, len, flags | MSG_NOSIGNAL) < 0 ? -errno : 0;
+    }
+
+    static void *run(void *arg)
+    {
+        FakeNanoHub *hub = (FakeNanoHub *)arg;
+
+        while (!__atomic_load_n(&hub->mStop, __ATOMIC_ACQUIRE)) {
+            hub->drainConfigs();
+            if (hub->mStream) {
+                hub->sendAccel(4, 0);
+            }
+        }
+
+        return NULL;
+    }
+
+    void drainConfigs(void)
+    {
+        struct sensor_config config;
+        struct pollfd pfd = { mHubFd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, FAKE_NANOHUB_POLL_MS) <= 0) {
+            return;
+        }
+        while (recv(mHubFd, &config, sizeof(config), MSG_DONTWAIT) > 0) {
+            __atomic_fetch_add(&mConfigs, 1, __ATOMIC_RELEASE);
+            if (config.evtType != EVT_NO_SENSOR_CONFIG_EVENT) {
+                continue;
+            }
+            if (config.flush) {
+                sendAccel(0, 1, 0);
+            } else if (!config.setBias && !config.calibrate &&
+                       config.sensorType == handle_to_nanohub_type(NANOHUB_ACCEL)) {
+                pthread_mutex_lock(&mLock);
+                mAccelConfig = config;
+                mAccelSeen = true;
+                pthread_mutex_unlock(&mLock);
+            }
+        }
+    }
+};
+
+#endif  // NANOHUB_FAKE_NANOHUB_H
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "fake_nanohub.h"
+#include "nanohub.h"
+#include "nanohub_cal.h"
+
+#ifdef __ANDROID__
+#define CAL_TEST_DIR        "/data/local/tmp"
+#else
+#define CAL_TEST_DIR        "/tmp"
+#endif
+
+#define CAL_WRITE_WAIT_MS   1000    /* the writer thread stores by then */
+#define CAL_POLL_MS         10
+
+/* the file layout NanoHubCalibration reads and writes */
+struct cal_test_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+} __attribute__((packed));
+
+struct cal_test_entry {
+    uint8_t sensorType;
+    uint8_t pad[3];
+    float bias[3];
+} __attribute__((packed));
+
+class NanoHubCalTest : public ::testing::Test {
+protected:
+    char mPath[64];
+
+    virtual void SetUp()
+    {
+        snprintf(mPath, sizeof(mPath), CAL_TEST_DIR "/nanohub_cal_test.%d", getpid());
+        unlink(mPath);
+    }
+
+    virtual void TearDown()
+    {
+        unlink(mPath);
+    }
+
+    /* a file with one accel entry, under the given header */
+    void writeFile(uint32_t magic, uint32_t version, const float bias[3])
+    {
+        struct cal_test_header hdr = { magic, version, 1 };
+        struct cal_test_entry entry;
+        int fd;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.sensorType = handle_to_nanohub_type(NANOHUB_ACCEL);
+        memcpy(entry.bias, bias, sizeof(entry.bias));
+
+        fd = open(mPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ((ssize_t)sizeof(hdr), write(fd, &hdr, sizeof(hdr)));
+        ASSERT_EQ((ssize_t)sizeof(entry), write(fd, &entry, sizeof(entry)));
+        close(fd);
+    }
+};
+
+TEST_F(NanoHubCalTest, RoundTrip)
+{
+    const float accel[3] = { 0.1f, -0.2f, 0.3f };
+    const float gyro[3] = { 0.01f, 0.02f, -0.03f };
+    const float light[3] = { 1.0f, 2.0f, 3.0f };
+    float bias[3];
+
+    {
+        NanoHubCalibration cal;
+
+        cal.load(mPath);
+        EXPECT_FALSE(cal.get(NANOHUB_ACCEL, bias));
+        cal.update(NANOHUB_ACCEL, accel, 0);
+        cal.update(NANOHUB_GYRO, gyro, 0);
+        cal.update(NANOHUB_ALS, light, 0);
+        cal.save();
+    }
+
+    NanoHubCalibration cal;
+
+    cal.load(mPath);
+    ASSERT_TRUE(cal.get(NANOHUB_ACCEL, bias));
+    EXPECT_EQ(0, memcmp(accel, bias, sizeof(bias)));
+    ASSERT_TRUE(cal.get(NANOHUB_GYRO, bias));
+    EXPECT_EQ(0, memcmp(gyro, bias, sizeof(bias)));
+    EXPECT_FALSE(cal.get(NANOHUB_MAG, bias));
+    EXPECT_FALSE(cal.get(NANOHUB_ALS, bias));
+}
+
+/* update() only wakes the writer thread, which stores the file */
+TEST_F(NanoHubCalTest, StoredByWriter)
+{
+    const float accel[3] = { 0.1f, -0.2f, 0.3f };
+    NanoHubCalibration cal;
+    int waited;
+
+    cal.load(mPath);
+    cal.update(NANOHUB_ACCEL, accel, NANOHUB_CAL_SAVE_NS);
+    for (waited = 0; waited < CAL_WRITE_WAIT_MS && access(mPath, F_OK); waited += CAL_POLL_MS) {
+        usleep(CAL_POLL_MS * 1000);
+    }
+    EXPECT_EQ(0, access(mPath, F_OK));
+}
+
+TEST_F(NanoHubCalTest, BadMagicIgnored)
+{
+    const float accel[3] = { 0.1f, -0.2f, 0.3f };
+    NanoHubCalibration cal;
+    float bias[3];
+
+    writeFile(NANOHUB_CAL_MAGIC + 1, NANOHUB_CAL_VERSION, accel);
+    cal.load(mPath);
+    EXPECT_FALSE(cal.get(NANOHUB_ACCEL, bias));
+}
+
+TEST_F(NanoHubCalTest, BadVersionIgnored)
+{
+    const float accel[3] = { 0.1f, -0.2f, 0.3f };
+    NanoHubCalibration cal;
+    float bias[3];
+
+    writeFile(NANOHUB_CAL_MAGIC, NANOHUB_CAL_VERSION + 1, accel);
+    cal.load(mPath);
+    EXPECT_FALSE(cal.get(NANOHUB_ACCEL, bias));
+}
+
+/*
+ * Opening the hub hands the stored bias back in a setBias config, and
+ * raw samples are corrected with it until the hub reports its own.
+ */
+TEST_F(NanoHubCalTest, RestoredOnOpen)
+{
+    const float accel[3] = { 0.0f, 0.0f, 1.0f };
+    struct sensor_bias_config config;
+    sensors_event_t data[16];
+    FakeNanoHub fake;
+    NanoHub *hub;
+    int client, pipeFds[2];
+    bool restored = false;
+
+    writeFile(NANOHUB_CAL_MAGIC, NANOHUB_CAL_VERSION, accel);
+    ASSERT_EQ(0, pipe(pipeFds));
+    hub = new NanoHub(sFakeSensors, 1, fake.halFd(), mPath);
+
+    while (recv(fake.hubFd(), &config, sizeof(config), MSG_DONTWAIT) > 0) {
+        if (config.config.setBias &&
+            config.config.sensorType == handle_to_nanohub_type(NANOHUB_ACCEL)) {
+            EXPECT_EQ(0, memcmp(accel, config.bias, sizeof(config.bias)));
+            restored = true;
+        }
+    }
+    EXPECT_TRUE(restored);
+
+    client = hub->attach(pipeFds[1]);
+    ASSERT_GE(client, 0);
+    ASSERT_EQ(0, hub->activate(client, NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, fake.sendAccel(4, 0));
+    ASSERT_EQ(4, hub->readEvents(client, data, 16));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_FLOAT_EQ(9.81f - accel[2], data[i].acceleration.z);
+    }
+
+    hub->detach(client);
+    delete hub;
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cost of host fusion: NanoHubFusion::process() fed a synthetic device
+ * turning slowly, gyro and accel at 200 Hz and mag at 50 Hz as the hub
+ * batches them, with every fused output enabled. Reports input samples
+ * and fused events per second of CPU time on one core.
+ *
+ * usage: nanohub_fusion_benchmark [seconds]
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <hardware/sensors.h>
+
+#include "nanohub_fusion.h"
+#include "nanohub_handles.h"
+
+#define BENCH_SECONDS       2           /* default run */
+#define BENCH_GYRO_NS       5000000LL   /* 200 Hz */
+#define BENCH_MAG_EVERY     4           /* 50 Hz */
+#define BENCH_ROUND         1000        /* gyro samples of input, between clock reads */
+
+/* one gyro period of input, precomputed so that only fusion is timed */
+struct bench_input {
+    float gyro[3];
+    float accel[3];
+    float mag[3];
+};
+
+static struct bench_input sInput[BENCH_ROUND];
+
+/* about 0.3 rad/s around a wobbling axis, tilt and heading follow */
+static void make_input(void)
+{
+    struct bench_input *in;
+    float t;
+
+    for (int i = 0; i < BENCH_ROUND; i++) {
+        in = &sInput[i];
+        t = i * BENCH_GYRO_NS / 1e9f;
+        in->gyro[0] = 0.1f * sinf(0.5f * t);
+        in->gyro[1] = 0.1f * cosf(0.7f * t);
+        in->gyro[2] = 0.3f;
+        in->accel[0] = 9.81f * sinf(0.1f * sinf(0.5f * t));
+        in->accel[1] = 9.81f * sinf(0.1f * cosf(0.7f * t));
+        in->accel[2] = 9.81f * cosf(0.1f);
+        in->mag[0] = 22.0f * cosf(0.3f * t);
+        in->mag[1] = 22.0f * sinf(0.3f * t);
+        in->mag[2] = -40.0f;
+    }
+}
+
+static double cpu_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    sensors_event_t out[NANOHUB_FUSION_EVENTS_MAX];
+    NanoHubFusion fusion;
+    double seconds = argc > 1 ? atof(argv[1]) : BENCH_SECONDS;
+    double start, elapsed;
+    uint64_t samples = 0, events = 0;
+    int64_t time = 0;
+    float sink = 0.0f;
+
+    make_input();
+    fusion.setActive(NANOHUB_FUSION_HANDLES);
+
+    start = cpu_seconds();
+    do {
+        for (int i = 0; i < BENCH_ROUND; i++) {
+            time += BENCH_GYRO_NS;
+            events += fusion.process(NANOHUB_ACCEL, time, sInput[i].accel, out);
+            if (i % BENCH_MAG_EVERY == 0) {
+                events += fusion.process(NANOHUB_MAG, time, sInput[i].mag, out);
+                samples++;
+            }
+            events += fusion.process(NANOHUB_GYRO, time, sInput[i].gyro, out);
+            samples += 2;
+            sink += out[0].data[0];
+        }
+        elapsed = cpu_seconds() - start;
+    } while (elapsed < seconds);
+
+    printf("host fusion: %" PRIu64 " samples, %" PRIu64 " events in %.3f s cpu\n",
+           samples, events, elapsed);
+    printf("  %.0f samples/s, %.0f events/s, %.1f ns/sample on one core (%g)\n",
+           samples / elapsed, events / elapsed, elapsed * 1e9 / samples, sink);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <utils/Timers.h>
+
+#include "fake_nanohub.h"
+#include "nanohub.h"
+
+#define READ_BLOCK_NS       50000000    /* a read() this slow has blocked */
+#define READ_HANGUP_WAIT_MS 100         /* wait() with the hub hung up */
+
+/*
+ * The hub polls readable but the packet is gone by the time we read
+ * (another reader took it, or the driver dropped it): readEvents()
+ * must come back empty at once instead of blocking.
+ */
+TEST(NanoHubRead, StalePollinReturnsNothing)
+{
+    FakeNanoHub fake;
+    struct NanohubReadEventResponse rsp;
+    sensors_event_t data[16];
+    struct pollfd pfd;
+    NanoHub *hub;
+    int64_t start;
+    int client, pipeFds[2];
+
+    ASSERT_EQ(0, pipe(pipeFds));
+    hub = new NanoHub(sFakeSensors, 1, fake.halFd());
+    client = hub->attach(pipeFds[1]);
+    ASSERT_GE(client, 0);
+    ASSERT_EQ(0, hub->activate(client, NANOHUB_ACCEL, 1));
+
+    ASSERT_EQ(0, fake.sendAccel(4, 0));
+    pfd.fd = hub->getPollFd(client);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ASSERT_EQ(1, poll(&pfd, 1, 0));
+    ASSERT_TRUE(pfd.revents & POLLIN);
+    ASSERT_GT(read(fake.halFd(), &rsp, sizeof(rsp)), 0);
+
+    start = systemTime(SYSTEM_TIME_BOOTTIME);
+    EXPECT_EQ(0, hub->readEvents(client, data, 16));
+    EXPECT_LT(systemTime(SYSTEM_TIME_BOOTTIME) - start, READ_BLOCK_NS);
+
+    /* the next packet still comes through */
+    ASSERT_EQ(0, fake.sendAccel(4, 0));
+    EXPECT_EQ(4, hub->readEvents(client, data, 16));
+
+    hub->detach(client);
+    delete hub;
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+/*
+ * A read() that fails for real is not taken as "nothing there": it goes
+ * to recover(), which tries to reopen /dev/nanohub and, with no such
+ * device here, returns -EIO rather than the raw errno, leaving the next
+ * attempt to wait().
+ */
+TEST(NanoHubRead, ReadErrorRecovers)
+{
+    sensors_event_t data[16];
+    NanoHub *hub;
+    int client, pipeFds[2], dataFds[2];
+
+    ASSERT_EQ(0, pipe(pipeFds));
+
+    /* reading the write end of a pipe fails with EBADF */
+    ASSERT_EQ(0, pipe(dataFds));
+    fcntl(dataFds[1], F_SETFL, fcntl(dataFds[1], F_GETFL) | O_NONBLOCK);
+    hub = new NanoHub(sFakeSensors, 1, dataFds[1]);
+    client = hub->attach(pipeFds[1]);
+    ASSERT_GE(client, 0);
+
+    EXPECT_EQ(-EIO, hub->readEvents(client, data, 16));
+
+    hub->detach(client);
+    delete hub;
+    close(dataFds[0]);
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+/*
+ * A hub that hung up keeps polling POLLHUP. wait() takes that for a
+ * reset instead of returning it, and leaves the hub out of poll() while
+ * it backs off between reopen attempts, rather than spinning on it.
+ */
+TEST(NanoHubRead, HangupWaitsForReopen)
+{
+    FakeNanoHub fake;
+    struct pollfd pfd;
+    NanoHub *hub;
+    int64_t start;
+    int client, pipeFds[2];
+
+    ASSERT_EQ(0, pipe(pipeFds));
+    hub = new NanoHub(sFakeSensors, 1, fake.halFd());
+    client = hub->attach(pipeFds[1]);
+    ASSERT_GE(client, 0);
+    ASSERT_EQ(0, shutdown(fake.hubFd(), SHUT_RDWR));
+
+    pfd.fd = hub->getPollFd(client);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    start = systemTime(SYSTEM_TIME_BOOTTIME);
+    EXPECT_EQ(0, hub->wait(client, &pfd, 1, 0, READ_HANGUP_WAIT_MS));
+    EXPECT_GE(systemTime(SYSTEM_TIME_BOOTTIME) - start, READ_HANGUP_WAIT_MS * 1000000LL);
+    EXPECT_EQ(pfd.fd, hub->getPollFd(client));
+
+    hub->detach(client);
+    delete hub;
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
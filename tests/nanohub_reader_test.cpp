@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "fake_nanohub.h"
+#include "nanohub.h"
+#include "nanohub_reader.h"
+
+#define READER_WAIT_MS      1000    /* a batch this late was never queued */
+
+/* two clients on one hub, which brings the reader up */
+class NanoHubReaderTest : public ::testing::Test {
+protected:
+    FakeNanoHub mFake;
+    NanoHub *mHub;
+    int mClients[2];
+    int mWakeFds[2][2];
+
+    virtual void SetUp()
+    {
+        mHub = new NanoHub(sFakeSensors, 1, mFake.halFd());
+        for (int i = 0; i < 2; i++) {
+            ASSERT_EQ(0, pipe(mWakeFds[i]));
+            mClients[i] = mHub->attach(mWakeFds[i][1]);
+            ASSERT_GE(mClients[i], 0);
+        }
+        ASSERT_TRUE(mHub->getReader() != NULL);
+    }
+
+    virtual void TearDown()
+    {
+        delete mHub;
+        for (int i = 0; i < 2; i++) {
+            close(mWakeFds[i][0]);
+            close(mWakeFds[i][1]);
+        }
+    }
+
+    /* one accel packet, read back by client i */
+    int sendAndRead(int i, sensors_event_t *data, int count)
+    {
+        return sendAndRead(i, 4, 0, data, count);
+    }
+
+    int sendAndRead(int i, int numSamples, int numFlushes, sensors_event_t *data, int count)
+    {
+        if (mFake.sendAccel(numSamples, numFlushes) < 0) {
+            return -1;
+        }
+
+        return readQueued(i, data, count);
+    }
+
+    /* what client i has queued, once there is something */
+    int readQueued(int i, sensors_event_t *data, int count)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = mHub->getPollFd(mClients[i]);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, READER_WAIT_MS) != 1) {
+            return -1;
+        }
+
+        return mHub->readEvents(mClients[i], data, count);
+    }
+};
+
+TEST_F(NanoHubReaderTest, QueuesOnlyForRoutedClients)
+{
+    sensors_event_t data[16];
+
+    ASSERT_EQ(0, mHub->activate(mClients[0], NANOHUB_ACCEL, 1));
+    EXPECT_EQ(4, sendAndRead(0, data, 16));
+    EXPECT_FALSE(mHub->hasPending(mClients[1]));
+}
+
+TEST_F(NanoHubReaderTest, FullQueueDoesNotStallOthers)
+{
+    sensors_event_t data[16 * NANOHUB_READER_RING];
+
+    ASSERT_EQ(0, mHub->activate(mClients[0], NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, mHub->activate(mClients[1], NANOHUB_ACCEL, 1));
+
+    /* client 1 never reads while client 0 keeps up */
+    for (int i = 0; i < 3 * NANOHUB_READER_RING; i++) {
+        ASSERT_EQ(4, sendAndRead(0, data, 16)) << "batch " << i;
+    }
+
+    /* client 1 kept what fit and missed the rest */
+    EXPECT_EQ(4 * NANOHUB_READER_RING,
+              mHub->readEvents(mClients[1], data, 16 * NANOHUB_READER_RING));
+}
+
+/*
+ * A flush completion is tagged for the client that asked for it. The
+ * samples decoded into its slot afterwards must not keep that tag, or
+ * they would reach that client only.
+ */
+TEST_F(NanoHubReaderTest, FlushTagDoesNotStickToSamples)
+{
+    sensors_event_t data[16];
+
+    ASSERT_EQ(0, mHub->activate(mClients[0], NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, mHub->activate(mClients[1], NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, mHub->batch(mClients[0], NANOHUB_ACCEL, 5000000, 100000000));
+    ASSERT_EQ(0, mHub->flush(mClients[0], NANOHUB_ACCEL));
+
+    ASSERT_EQ(1, sendAndRead(0, 0, 1, data, 16));
+    EXPECT_EQ(SENSOR_TYPE_META_DATA, data[0].type);
+    EXPECT_FALSE(mHub->hasPending(mClients[1]));
+
+    /* one batch, both clients get all of it */
+    ASSERT_EQ(4, sendAndRead(0, data, 16));
+    for (int i = 0; i < 2; i++) {
+        if (i) {
+            ASSERT_EQ(4, readQueued(i, data, 16));
+        }
+        for (int j = 0; j < 4; j++) {
+            EXPECT_EQ(SENSOR_TYPE_ACCELEROMETER, data[j].type) << "client " << i;
+        }
+    }
+}
+
+/*
+ * A client whose queue is full misses batches, but not the flush
+ * completions it asked for: they reach it once it has read what was
+ * queued before them.
+ */
+TEST_F(NanoHubReaderTest, FullQueueKeepsFlushCompletions)
+{
+    sensors_event_t data[16 * NANOHUB_READER_RING];
+    int n;
+
+    ASSERT_EQ(0, mHub->activate(mClients[0], NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, mHub->activate(mClients[1], NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, mHub->batch(mClients[1], NANOHUB_ACCEL, 5000000, 100000000));
+
+    for (int i = 0; i < NANOHUB_READER_RING; i++) {
+        ASSERT_EQ(4, sendAndRead(0, data, 16)) << "batch " << i;
+    }
+    ASSERT_EQ(0, mHub->flush(mClients[1], NANOHUB_ACCEL));
+    ASSERT_EQ(0, mFake.sendAccel(0, 1));
+    ASSERT_EQ(4, sendAndRead(0, data, 16));
+
+    EXPECT_EQ(4 * NANOHUB_READER_RING,
+              mHub->readEvents(mClients[1], data, 16 * NANOHUB_READER_RING));
+
+    /* the last batch may reach client 1 after it made room, never before */
+    n = readQueued(1, data, 16);
+    ASSERT_TRUE(n == 1 || n == 5) << n;
+    EXPECT_EQ(SENSOR_TYPE_META_DATA, data[0].type);
+    EXPECT_EQ(META_DATA_FLUSH_COMPLETE, data[0].meta_data.what);
+    EXPECT_EQ(NANOHUB_ACCEL, data[0].meta_data.sensor);
+    for (int i = 1; i < n; i++) {
+        EXPECT_EQ(SENSOR_TYPE_ACCELEROMETER, data[i].type);
+    }
+}
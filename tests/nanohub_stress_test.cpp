@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "fake_nanohub.h"
+#include "nanohub.h"
+
+#define STRESS_RUN_MS       300     /* activate/batch/flush against poll */
+#define STRESS_CLIENTS      2       /* more than one brings up the reader */
+#define STRESS_SETTLE_MS    1000    /* for the hub and the pollers to catch up */
+#define STRESS_POLL_MS      10
+
+/* one HAL open: its client slot, wake pipe, poll and control threads */
+struct stress_client {
+    NanoHub *hub;
+    int client;
+    int wakeFds[2];
+    pthread_t poller;
+    pthread_t control;
+    bool stop;
+    int events;
+    int flushes;        /* flush() calls that succeeded */
+    int flushed;        /* flush completions the poller got */
+};
+
+/*
+ * poll_client: what pollEvents() does, for as long as the client lives;
+ * the hub returns 0 from wait() once it is detaching.
+ */
+static void *poll_client(void *arg)
+{
+    struct stress_client *c = (struct stress_client *)arg;
+    sensors_event_t data[16];
+    struct pollfd fds[2];
+    char msg;
+    int n;
+
+    if (!c->hub->enter(c->client)) {
+        return NULL;
+    }
+
+    fds[1].fd = c->wakeFds[0];
+    fds[1].events = POLLIN;
+    for (;;) {
+        fds[0].fd = c->hub->getPollFd(c->client);
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        n = c->hub->wait(c->client, fds, 2, 0, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            break;
+        }
+        if ((fds[1].revents & POLLIN) && read(c->wakeFds[0], &msg, 1) < 0) {
+            break;
+        }
+        n = c->hub->readEvents(c->client, data, 16);
+        for (int i = 0; i < n; i++) {
+            if (data[i].type == SENSOR_TYPE_META_DATA &&
+                data[i].meta_data.what == META_DATA_FLUSH_COMPLETE) {
+                EXPECT_EQ(NANOHUB_ACCEL, data[i].meta_data.sensor);
+                __atomic_fetch_add(&c->flushed, 1, __ATOMIC_RELEASE);
+            } else {
+                c->events++;
+            }
+        }
+    }
+
+    c->hub->leave(c->client);
+    return NULL;
+}
+
+/* control_client: the framework reconfiguring the client while it polls */
+static void *control_client(void *arg)
+{
+    struct stress_client *c = (struct stress_client *)arg;
+    int round = 0;
+
+    while (!__atomic_load_n(&c->stop, __ATOMIC_ACQUIRE)) {
+        c->hub->batch(c->client, NANOHUB_ACCEL, (round & 1) ? 5000000 : 20000000,
+                      (round & 2) ? 100000000 : 0);
+        c->hub->activate(c->client, NANOHUB_ACCEL, 1);
+        if (c->hub->flush(c->client, NANOHUB_ACCEL) == 0) {
+            c->flushes++;
+        }
+        if ((round & 7) == 7) {
+            c->hub->activate(c->client, NANOHUB_ACCEL, 0);
+        }
+        round++;
+    }
+
+    return NULL;
+}
+
+static void start_client(NanoHub *hub, struct stress_client *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->hub = hub;
+    ASSERT_EQ(0, pipe(c->wakeFds));
+    c->client = hub->attach(c->wakeFds[1]);
+    ASSERT_GE(c->client, 0);
+    ASSERT_EQ(0, pthread_create(&c->poller, NULL, poll_client, c));
+    ASSERT_EQ(0, pthread_create(&c->control, NULL, control_client, c));
+}
+
+static void stop_control(struct stress_client *c)
+{
+    __atomic_store_n(&c->stop, true, __ATOMIC_RELEASE);
+    pthread_join(c->control, NULL);
+}
+
+/* every flush a client asked for comes back to it, once */
+static void expect_flushes(struct stress_client *c)
+{
+    for (int waited = 0; waited < STRESS_SETTLE_MS; waited += STRESS_POLL_MS) {
+        if (__atomic_load_n(&c->flushed, __ATOMIC_ACQUIRE) >= c->flushes) {
+            break;
+        }
+        usleep(STRESS_POLL_MS * 1000);
+    }
+    EXPECT_GT(c->flushes, 0);
+    EXPECT_EQ(c->flushes, __atomic_load_n(&c->flushed, __ATOMIC_ACQUIRE))
+        << "client " << c->client;
+}
+
+/* the hub ends up running accel the way the clients' requests add up */
+static void expect_accel(FakeNanoHub *fake, bool enable, uint32_t rate, uint64_t latency)
+{
+    struct sensor_config config;
+    bool seen = false;
+
+    for (int waited = 0; waited < STRESS_SETTLE_MS; waited += STRESS_POLL_MS) {
+        seen = fake->lastAccelConfig(&config);
+        if (seen && config.enable == enable && (!enable || (config.rate == rate &&
+            config.latency == latency))) {
+            return;
+        }
+        usleep(STRESS_POLL_MS * 1000);
+    }
+    ASSERT_TRUE(seen);
+    EXPECT_EQ(enable, config.enable);
+    if (enable) {
+        EXPECT_EQ(rate, config.rate);
+        EXPECT_EQ(latency, config.latency);
+    }
+}
+
+static void close_client(struct stress_client *c)
+{
+    pthread_join(c->poller, NULL);
+    close(c->wakeFds[0]);
+    close(c->wakeFds[1]);
+}
+
+TEST(NanoHubStress, DetachWaitsForPoller)
+{
+    FakeNanoHub fake;
+    struct stress_client c;
+    NanoHub *hub;
+
+    ASSERT_EQ(0, fake.start(true));
+    hub = new NanoHub(sFakeSensors, 1, fake.halFd());
+    start_client(hub, &c);
+
+    usleep(STRESS_RUN_MS * 1000);
+    stop_control(&c);
+    expect_flushes(&c);
+
+    ASSERT_EQ(0, hub->batch(c.client, NANOHUB_ACCEL, 20000000, 100000000));
+    ASSERT_EQ(0, hub->activate(c.client, NANOHUB_ACCEL, 1));
+    expect_accel(&fake, true, SENSOR_HZ(50), 100000000);
+    ASSERT_EQ(0, hub->activate(c.client, NANOHUB_ACCEL, 0));
+    expect_accel(&fake, false, 0, 0);
+
+    /* detach() only returns once the poller left, then it stays out */
+    hub->detach(c.client);
+    close_client(&c);
+    EXPECT_GT(c.events, 0);
+    EXPECT_FALSE(hub->enter(c.client));
+
+    delete hub;
+}
+
+TEST(NanoHubStress, CloseWithClientsInside)
+{
+    FakeNanoHub fake;
+    struct stress_client c[STRESS_CLIENTS];
+    NanoHub *hub;
+
+    ASSERT_EQ(0, fake.start(true));
+    hub = new NanoHub(sFakeSensors, 1, fake.halFd());
+    for (int i = 0; i < STRESS_CLIENTS; i++) {
+        start_client(hub, &c[i]);
+    }
+    ASSERT_TRUE(hub->getReader() != NULL);
+
+    usleep(STRESS_RUN_MS * 1000);
+    for (int i = 0; i < STRESS_CLIENTS; i++) {
+        stop_control(&c[i]);
+    }
+    for (int i = 0; i < STRESS_CLIENTS; i++) {
+        expect_flushes(&c[i]);
+    }
+
+    /* the fastest rate and the shortest latency win, until that client stops */
+    ASSERT_EQ(0, hub->batch(c[0].client, NANOHUB_ACCEL, 20000000, 100000000));
+    ASSERT_EQ(0, hub->activate(c[0].client, NANOHUB_ACCEL, 1));
+    ASSERT_EQ(0, hub->batch(c[1].client, NANOHUB_ACCEL, 5000000, 0));
+    ASSERT_EQ(0, hub->activate(c[1].client, NANOHUB_ACCEL, 1));
+    expect_accel(&fake, true, SENSOR_HZ(200), 0);
+    ASSERT_EQ(0, hub->activate(c[1].client, NANOHUB_ACCEL, 0));
+    expect_accel(&fake, true, SENSOR_HZ(50), 100000000);
+
+    /* the pollers are still in wait() or readEvents() */
+    delete hub;
+    for (int i = 0; i < STRESS_CLIENTS; i++) {
+        close_client(&c[i]);
+        EXPECT_GT(c[i].events, 0);
+    }
+}